@@ -95,7 +95,7 @@ void NWK_DataReq(int dst, uint8_t *data, int size)
   nwkDataCmd.header.dst = dst;
   nwkDataCmd.header.command = NWK_COMMAND_DATA;
 
-  memcpy(nwkDataCmd.data, data, size);
+  sim_memcpy(nwkDataCmd.data, data, size);
 
   nwkDataReq((uint8_t *)&nwkDataCmd, sizeof(NwkHeader_t) + size);
 }
@@ -40,6 +40,12 @@
 #define SYS_CTRL_LOG           MMIO_REG(0x0100000c, char *)
 #define SYS_CTRL_INTENSET      MMIO_REG(0x01000010, uint32_t)
 #define SYS_CTRL_INTENCLR      MMIO_REG(0x01000014, uint32_t)
+#define SYS_CTRL_CALL_SRC      MMIO_REG(0x01000018, uint32_t)
+#define SYS_CTRL_CALL_DST      MMIO_REG(0x0100001c, uint32_t)
+#define SYS_CTRL_CALL_SIZE     MMIO_REG(0x01000020, uint32_t)
+#define SYS_CTRL_CALL_VALUE    MMIO_REG(0x01000024, uint32_t)
+#define SYS_CTRL_CALL_CMD      MMIO_REG(0x01000028, uint32_t)
+#define SYS_CTRL_CALL_RESULT   MMIO_REG(0x0100002c, uint32_t)
 
 #define SYS_TIMER_CONTROL      SYS_TIMER0_CONTROL
 #define SYS_TIMER_PERIOD       SYS_TIMER0_PERIOD
@@ -105,6 +111,18 @@
 #define TRX_FRAME_RSSI         MMIO_REG(0x40000054, float)
 #define TRX_FRAME_BUFFER(i)    MMIO_REG(0x40001000 + (i), uint8_t)
 
+#define SCS_SYST_CSR           MMIO_REG(0xe000e010, uint32_t)
+#define SCS_SYST_RVR           MMIO_REG(0xe000e014, uint32_t)
+#define SCS_SYST_CVR           MMIO_REG(0xe000e018, uint32_t)
+#define SCS_SYST_CALIB         MMIO_REG(0xe000e01c, uint32_t)
+#define SCS_NVIC_ISER          MMIO_REG(0xe000e100, uint32_t)
+#define SCS_NVIC_ICER          MMIO_REG(0xe000e180, uint32_t)
+#define SCS_CPUID              MMIO_REG(0xe000ed00, uint32_t)
+#define SCS_ICSR               MMIO_REG(0xe000ed04, uint32_t)
+#define SCS_SCR                MMIO_REG(0xe000ed10, uint32_t)
+#define SCS_SHPR2              MMIO_REG(0xe000ed1c, uint32_t)
+#define SCS_SHPR3              MMIO_REG(0xe000ed20, uint32_t)
+
 #define BREAK                  MMIO_REG(0xff000000, uint32_t)
 
 /*- Types -------------------------------------------------------------------*/
@@ -117,11 +135,41 @@ enum
   SOC_IRQ_SYS_TIMER_3 = 1 << 4,
 };
 
+enum
+{
+  SYS_CTRL_CALL_MEMCPY = 1,
+  SYS_CTRL_CALL_MEMSET = 2,
+  SYS_CTRL_CALL_MEMCMP = 3,
+  SYS_CTRL_CALL_CRC16  = 4,
+  SYS_CTRL_CALL_CRC32  = 5,
+};
+
 enum
 {
   SYS_TIMER_INTFLAG_COUNT = 1 << 0,
 };
 
+enum
+{
+  SCS_SYST_CSR_ENABLE     = 1 << 0,
+  SCS_SYST_CSR_TICKINT    = 1 << 1,
+  SCS_SYST_CSR_CLKSOURCE  = 1 << 2,
+  SCS_SYST_CSR_COUNTFLAG  = 1 << 16,
+};
+
+enum
+{
+  SCS_ICSR_PENDSTCLR      = 1 << 25,
+  SCS_ICSR_PENDSTSET      = 1 << 26,
+};
+
+enum
+{
+  SCS_SCR_SLEEPONEXIT     = 1 << 1,
+  SCS_SCR_SLEEPDEEP       = 1 << 2,
+  SCS_SCR_SEVONPEND       = 1 << 4,
+};
+
 enum
 {
   TRX_CONFIG_TX_AUTO_CRC       = 1 << 0,
@@ -176,5 +224,71 @@ enum
   TRX_IRQ_TX_END   = 1 << 2,
 };
 
+/*- Implementations ---------------------------------------------------------*/
+// Hypercalls are done by the simulator in one register write. The arguments
+// are shared, so the same call must not be used from both interrupt handlers
+// and the main code without disabling interrupts. The compiler barriers
+// around the command write order the buffer accesses with the call.
+
+//-----------------------------------------------------------------------------
+static inline void *sim_memcpy(void *dst, const void *src, uint32_t size)
+{
+  SYS_CTRL_CALL_SRC = (uint32_t)src;
+  SYS_CTRL_CALL_DST = (uint32_t)dst;
+  SYS_CTRL_CALL_SIZE = size;
+  __asm__ volatile ("" ::: "memory");
+  SYS_CTRL_CALL_CMD = SYS_CTRL_CALL_MEMCPY;
+  __asm__ volatile ("" ::: "memory");
+  return dst;
+}
+
+//-----------------------------------------------------------------------------
+static inline void *sim_memset(void *dst, int value, uint32_t size)
+{
+  SYS_CTRL_CALL_DST = (uint32_t)dst;
+  SYS_CTRL_CALL_SIZE = size;
+  SYS_CTRL_CALL_VALUE = (uint8_t)value;
+  __asm__ volatile ("" ::: "memory");
+  SYS_CTRL_CALL_CMD = SYS_CTRL_CALL_MEMSET;
+  __asm__ volatile ("" ::: "memory");
+  return dst;
+}
+
+//-----------------------------------------------------------------------------
+static inline int sim_memcmp(const void *a, const void *b, uint32_t size)
+{
+  SYS_CTRL_CALL_SRC = (uint32_t)a;
+  SYS_CTRL_CALL_DST = (uint32_t)b;
+  SYS_CTRL_CALL_SIZE = size;
+  __asm__ volatile ("" ::: "memory");
+  SYS_CTRL_CALL_CMD = SYS_CTRL_CALL_MEMCMP;
+  __asm__ volatile ("" ::: "memory");
+  return (int)SYS_CTRL_CALL_RESULT;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint16_t sim_crc16(uint16_t crc, const void *data, uint32_t size)
+{
+  SYS_CTRL_CALL_SRC = (uint32_t)data;
+  SYS_CTRL_CALL_SIZE = size;
+  SYS_CTRL_CALL_VALUE = crc;
+  __asm__ volatile ("" ::: "memory");
+  SYS_CTRL_CALL_CMD = SYS_CTRL_CALL_CRC16;
+  __asm__ volatile ("" ::: "memory");
+  return SYS_CTRL_CALL_RESULT;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t sim_crc32(uint32_t crc, const void *data, uint32_t size)
+{
+  SYS_CTRL_CALL_SRC = (uint32_t)data;
+  SYS_CTRL_CALL_SIZE = size;
+  SYS_CTRL_CALL_VALUE = crc;
+  __asm__ volatile ("" ::: "memory");
+  SYS_CTRL_CALL_CMD = SYS_CTRL_CALL_CRC32;
+  __asm__ volatile ("" ::: "memory");
+  return SYS_CTRL_CALL_RESULT;
+}
+
 #endif // _SIMULATOR_H_
 
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include "../core.c"
+
+/*- Definitions -------------------------------------------------------------*/
+#define VECTORS_SIZE   48
+#define REGION_CHUNK   64
+
+/*- Variables ---------------------------------------------------------------*/
+sim_t g_sim;
+__thread part_t *g_part = &g_sim.part;
+
+static core_t core;
+static image_t image;
+static uint8_t flash[CORE_FLASH_SIZE];
+static bool visited[CORE_FLASH_SIZE / 2];
+static bool entry[CORE_FLASH_SIZE / 2];
+static int blocks[CORE_FLASH_SIZE / 2];
+static uint32_t stack[CORE_FLASH_SIZE / 2];
+static int stack_size = 0;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+uint8_t soc_read_b(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+uint16_t soc_read_h(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t soc_read_w(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_b(soc_t *soc, uint32_t addr, uint8_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_h(soc_t *soc, uint32_t addr, uint16_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_w(soc_t *soc, uint32_t addr, uint32_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void trace_flush(trace_t *trace)
+{
+  (void)trace;
+}
+
+//-----------------------------------------------------------------------------
+static void push(uint32_t addr)
+{
+  addr &= ~1;
+
+  if (addr < CORE_FLASH_SIZE && !visited[addr >> 1])
+  {
+    visited[addr >> 1] = true;
+    stack[stack_size++] = addr;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void walk(uint32_t addr)
+{
+  block_t *block = core_block_build(&core, addr);
+  uint32_t pc = addr, last = addr;
+  decoded_t *d = &block->code[block->count - 1];
+  handler_t *h;
+
+  for (int i = 0; i < block->count; i++)
+  {
+    entry[pc >> 1] = true;
+    last = pc;
+    pc += (FMT_32BIT == hash[core.flash[pc >> 1]]->format) ? 4 : 2;
+  }
+
+  h = hash[core.flash[last >> 1]]->handler;
+
+  // Only direct branch targets are known statically. Code reached through
+  // computed branches is left to the interpreter.
+  if (i_b_imm == h)
+    push(last + 2 + d->imm);
+  else if (i_b_c_imm == h)
+  {
+    push(last + 2 + d->imm);
+    push(pc);
+  }
+  else if (i_bl == d->handler)
+  {
+    push(last + 4 + d->imm);
+    push(pc);
+  }
+  else if (i_blx_reg4 == h)
+    push(pc);
+  else if (EXEC_BX == d->exec || EXEC_BRANCH == d->exec || (EXEC_POP == d->exec && d->r1))
+    ;
+  else
+    push(pc);
+
+  sim_free(block);
+}
+
+//-----------------------------------------------------------------------------
+static int handler_index(FILE *f, handler_t *handler)
+{
+  for (int i = 0; i < (int)ARRAY_SIZE(instructions); i++)
+  {
+    if (instructions[i].handler == handler)
+      return fprintf(f, "instructions[%d].handler", i);
+  }
+
+  for (int i = 0; i < (int)ARRAY_SIZE(instructions_32bit); i++)
+  {
+    if (instructions_32bit[i].handler == handler)
+      return fprintf(f, "instructions_32bit[%d].handler", i);
+  }
+
+  error("unknown instruction handler");
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int region_build(uint32_t addr, decoded_t *code, uint32_t *pcs)
+{
+  uint32_t pc = addr;
+  int count = 0;
+
+  // Same rules as core_block_build(), but without the run length limit
+  while (pc < CORE_FLASH_SIZE)
+  {
+    decoded_t *d = &code[count];
+
+    core_decode(&core, pc, d);
+
+    if (count > 0 && (EXEC_FIRST == d->exec || EXEC_ALONE == d->exec))
+      break;
+
+    pcs[count++] = pc;
+    pc += (FMT_32BIT == hash[core.flash[pc >> 1]]->format) ? 4 : 2;
+
+    if (EXEC_BRANCH == d->exec || EXEC_BX == d->exec || EXEC_ALONE == d->exec ||
+        (EXEC_POP == d->exec && d->r1))
+      break;
+  }
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+static int translate(FILE *f, uint32_t addr, int region)
+{
+  static decoded_t code[CORE_FLASH_SIZE / 2];
+  static uint32_t pcs[CORE_FLASH_SIZE / 2];
+  static int counts[CORE_FLASH_SIZE / 2];
+  int count = region_build(addr, code, pcs);
+  int chunks = (count + REGION_CHUNK - 1) / REGION_CHUNK;
+  int entries = 0;
+
+  // Every entry point inside the region runs up to the same end, limited
+  // by the run length.
+  for (int i = 0; i < count; i++)
+  {
+    block_t *block;
+
+    counts[i] = 0;
+
+    if (!entry[pcs[i] >> 1])
+      continue;
+
+    entry[pcs[i] >> 1] = false;
+    block = core_block_build(&core, pcs[i]);
+
+    if (block->count != (count - i < CORE_RUN_LIMIT ? count - i : CORE_RUN_LIMIT))
+      error("inconsistent block at 0x%08x", pcs[i]);
+
+    if (block->count > 1)
+    {
+      counts[i] = block->count;
+      entries++;
+    }
+
+    sim_free(block);
+  }
+
+  if (0 == entries)
+    return 0;
+
+  // Long regions are split into chunks to keep the host compiler happy,
+  // each chunk continues into the next one. Chunks are emitted backwards,
+  // so the next one is always defined first.
+  for (int chunk = region + chunks - 1; chunk >= region; chunk--)
+  {
+    int base = (chunk - region) * REGION_CHUNK;
+    int size = (count - base < REGION_CHUNK) ? count - base : REGION_CHUNK;
+    bool more = (base + size) < count;
+    bool target[REGION_CHUNK + 1] = { [0] = base > 0 };
+
+    for (int i = 0; i < size; i++)
+      target[i + 1] |= (counts[base + i] > 0);
+
+    fprintf(f, "//-----------------------------------------------------------------------------\n");
+    fprintf(f, "static int __attribute__((noinline)) aot_region_%d(core_t *core, int first, int count)\n", chunk);
+    fprintf(f, "{\n");
+    fprintf(f, "  static const decoded_t d[%d] =\n", size);
+    fprintf(f, "  {\n");
+
+    for (int i = base; i < base + size; i++)
+      fprintf(f, "    { NULL, 0x%08x, %d, %d, %d, %d },\n", code[i].imm, code[i].r1,
+          code[i].r2, code[i].r3, code[i].exec);
+
+    fprintf(f, "  };\n");
+    fprintf(f, "  int last = first + count - 1;\n\n");
+    fprintf(f, "  switch (first)\n");
+    fprintf(f, "  {\n");
+
+    for (int i = 0; i <= size; i++)
+    {
+      if (target[i])
+        fprintf(f, "    case %d: goto i%d;\n", i - 1, i);
+    }
+
+    fprintf(f, "  }\n\n");
+
+    for (int i = 0; i < size; i++)
+    {
+      if (0 == i && 0 == base)
+        continue;
+
+      if (target[i])
+        fprintf(f, "i%d:\n", i);
+
+      fprintf(f, "  if (%d > last || !core_can_continue(core, (decoded_t *)&d[%d]))\n", i, i);
+      fprintf(f, "    return %d - first;\n", i - 1);
+      fprintf(f, "  core->r[PC] += 2;\n");
+      fprintf(f, "  ");
+      handler_index(f, code[base + i].handler);
+      fprintf(f, "(core, (decoded_t *)&d[%d]);\n", i);
+    }
+
+    if (target[size])
+      fprintf(f, "i%d:\n", size);
+
+    if (more)
+    {
+      fprintf(f, "  if (%d > last)\n", size);
+      fprintf(f, "    return %d - first;\n", size - 1);
+      fprintf(f, "  return %d - first + aot_region_%d(core, -1, last - %d);\n", size - 1,
+          chunk + 1, size - 2);
+    }
+    else
+      fprintf(f, "  return %d - first;\n", size - 1);
+
+    fprintf(f, "}\n\n");
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    if (0 == counts[i])
+      continue;
+
+    fprintf(f, "//-----------------------------------------------------------------------------\n");
+    fprintf(f, "static int aot_0x%08x(core_t *core)\n", pcs[i]);
+    fprintf(f, "{\n");
+    fprintf(f, "  return aot_region_%d(core, %d, %d);\n", region + i / REGION_CHUNK,
+        i % REGION_CHUNK, counts[i]);
+    fprintf(f, "}\n\n");
+
+    blocks[pcs[i] >> 1] = counts[i];
+  }
+
+  return chunks;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  uint32_t *vectors = (uint32_t *)flash;
+  int fd, count = 0, regions = 0;
+  FILE *f;
+
+  if (3 != argc)
+  {
+    printf("Usage: %s <firmware> <output>\n", argv[0]);
+    return 0;
+  }
+
+  core_setup();
+
+  fd = open(argv[1], O_RDONLY);
+
+  if (fd < 0)
+    error("cannot open firmware file %s", argv[1]);
+
+  if (CORE_FLASH_SIZE == read(fd, flash, CORE_FLASH_SIZE))
+    error("firmware file %s is too big", argv[1]);
+
+  close(fd);
+
+  core.ram = flash;
+  core.flash_size = CORE_FLASH_SIZE;
+  core.mem_size = CORE_FLASH_SIZE;
+  core.flash = (uint16_t *)flash;
+  core.image = &image;
+
+  for (int i = 1; i < VECTORS_SIZE; i++)
+  {
+    if (vectors[i] & 1)
+      push(vectors[i]);
+  }
+
+  while (stack_size)
+    walk(stack[--stack_size]);
+
+  f = fopen(argv[2], "w");
+
+  if (NULL == f)
+    error("could not open output file '%s'", argv[2]);
+
+  fprintf(f, "// This file is generated by aot/aot.c from %s, do not edit.\n\n", argv[1]);
+  fprintf(f, "#include \"core.c\"\n\n");
+
+  for (int i = 0; i < CORE_FLASH_SIZE / 2; i++)
+  {
+    if (entry[i])
+    {
+      regions += translate(f, i * 2, regions);
+    }
+  }
+
+  fprintf(f, "#define EXPORT __attribute__((visibility(\"default\")))\n\n");
+  fprintf(f, "EXPORT const uint32_t aot_hash = 0x%08x;\n", core_aot_hash(core.flash, core.flash_size));
+  fprintf(f, "EXPORT const int aot_core_size = sizeof(core_t);\n");
+  fprintf(f, "EXPORT const aot_block_t aot_blocks[] =\n");
+  fprintf(f, "{\n");
+
+  for (int i = 0; i < CORE_FLASH_SIZE / 2; i++)
+  {
+    if (blocks[i])
+    {
+      fprintf(f, "  { 0x%08x, %d, aot_0x%08x },\n", i * 2, blocks[i], i * 2);
+      count++;
+    }
+  }
+
+  fprintf(f, "  { 0, 0, NULL },\n");
+  fprintf(f, "};\n\n");
+  fprintf(f, "EXPORT const int aot_count = %d;\n", count);
+  fclose(f);
+
+  printf("Translated %d blocks\n", count);
+
+  return 0;
+}
@@ -231,23 +231,6 @@ static sniffer_t *find_sniffer(char *name)
   return NULL;
 }
 
-//-----------------------------------------------------------------------------
-static void load_file(char *name, uint8_t *data, int size)
-{
-  int f, n;
-
-  f = open(name, O_RDONLY);
-
-  if (f < 0)
-    error("cannot open firmware file %s", name);
-
-  n = read(f, data, size);
-  close(f);
-
-  if (size == n)
-    error("firmware file %s is too big", name);
-}
-
 //-----------------------------------------------------------------------------
 static void process_line(char *line)
 {
@@ -271,6 +254,51 @@ static void process_line(char *line)
     g_sim.scale = get_float(&line);
   }
 
+  else if (check_str(&line, "memory"))
+  {
+    long flash_size = get_long(&line);
+    long ram_size = get_long(&line);
+
+    if (flash_size <= 0 || ram_size <= 0 || (flash_size % CORE_PAGE_SIZE) ||
+        (ram_size % CORE_PAGE_SIZE) || (flash_size + ram_size) > CORE_MEM_LIMIT)
+      error("%s:%d: memory sizes must be multiples of %d bytes and fit into %d bytes",
+          config_name, config_line, CORE_PAGE_SIZE, CORE_MEM_LIMIT);
+
+    g_sim.flash_size = flash_size;
+    g_sim.ram_size = ram_size;
+  }
+
+  else if (check_str(&line, "hypercall"))
+  {
+    long cycles = get_long(&line);
+    float byte_cycles = get_float(&line);
+
+    if (cycles < 0 || byte_cycles < 0.0f)
+      error("%s:%d: hypercall costs must not be negative", config_name, config_line);
+
+    g_sim.call_cycles = cycles;
+    g_sim.call_byte_cycles = byte_cycles;
+  }
+
+  else if (check_str(&line, "threads"))
+  {
+    long threads = get_long(&line);
+
+    if (threads < 1)
+      error("%s:%d: number of threads must be positive", config_name, config_line);
+
+    if (g_sim.node_uid || g_sim.noise_uid)
+      error("%s:%d: threads must be set before nodes and noise sources", config_name, config_line);
+
+#ifdef USE_STATS
+    error("%s:%d: threads are not supported with statistics", config_name, config_line);
+#endif
+
+    // Even with one thread this selects the delayed radio model of the
+    // parallel engine, the results differ from the unthreaded simulation
+    g_sim.threads = threads;
+  }
+
   else if (check_str(&line, "node"))
   {
     soc_t *soc = (soc_t *)sim_malloc(sizeof(soc_t));
@@ -285,10 +313,25 @@ static void process_line(char *line)
     if (find_node(soc->name))
       error("%s:%d: node '%s' already exists", config_name, config_line, soc->name);
 
-    load_file(soc->path, soc->core.ram, sizeof(soc->core.ram));
+    if (g_sim.threads)
+    {
+      part_t *part = (part_t *)sim_malloc(sizeof(part_t));
+
+      part_init(part);
+      part->thread = soc->uid % g_sim.threads;
+      soc->part = part;
+    }
+    else
+      soc->part = &g_sim.part;
+
+    g_part = soc->part;
+
+    soc_load(soc, g_sim.flash_size, g_sim.ram_size);
 
     soc_init(soc);
-    queue_add(&g_sim.active, (queue_t *)soc);
+    queue_add(&g_part->active, soc->core);
+
+    g_part = &g_sim.part;
   }
 
   else if (check_str(&line, "sniffer"))
@@ -381,6 +424,73 @@ static void process_line(char *line)
       error("%s:%d: '%s' does not name a node or a sniffer", config_name, config_line, node_name);
   }
 
+  else if (check_str(&line, "profile"))
+  {
+    profile_t *profile = (profile_t *)sim_malloc(sizeof(profile_t));
+    char *node_name = get_name(&line);
+    trx_t *node = find_node(node_name);
+
+    profile->period = get_long(&line);
+    profile->path = get_str(&line);
+
+    if (NULL == node)
+      error("%s:%d: '%s' does not name a node", config_name, config_line, node_name);
+
+    if (profile->period <= 0)
+      error("%s:%d: profiling period must be positive", config_name, config_line);
+
+    profile->soc = node->soc;
+    g_part = ((soc_t *)node->soc)->part;
+    profile_init(profile);
+    g_part = &g_sim.part;
+    queue_add(&g_sim.profiles, profile);
+  }
+
+  else if (check_str(&line, "native"))
+  {
+    char *node_name = get_name(&line);
+    trx_t *node = find_node(node_name);
+
+    if (NULL == node)
+      error("%s:%d: '%s' does not name a node", config_name, config_line, node_name);
+
+    skip_spaces(&line);
+
+    if (0 == line[0])
+    {
+      if (0 == native_bind_elf(node->soc))
+        error("%s:%d: no known routines found in the ELF file for node '%s'",
+            config_name, config_line, node_name);
+    }
+    else
+    {
+      char *routine = get_str(&line);
+      long addr = get_long(&line);
+
+      if (!native_bind(node->soc, routine, addr))
+        error("%s:%d: unknown native routine '%s'", config_name, config_line, routine);
+    }
+  }
+
+  else if (check_str(&line, "trace"))
+  {
+    trace_t *trace = (trace_t *)sim_malloc(sizeof(trace_t));
+    char *node_name = get_name(&line);
+    trx_t *node = find_node(node_name);
+
+    trace->path = get_str(&line);
+
+    if (NULL == node)
+      error("%s:%d: '%s' does not name a node", config_name, config_line, node_name);
+
+    if (((soc_t *)node->soc)->core->traced)
+      error("%s:%d: node '%s' is already traced", config_name, config_line, node_name);
+
+    trace->soc = node->soc;
+    trace_init(trace);
+    queue_add(&g_sim.traces, trace);
+  }
+
   else
     error("%s:%d:%d: invalid command", config_name, config_line, config_col);
 
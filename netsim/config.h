@@ -23,6 +23,9 @@
 #include "soc.h"
 #include "noise.h"
 #include "sniffer.h"
+#include "profile.h"
+#include "trace.h"
+#include "native.h"
 
 /*- Prototypes --------------------------------------------------------------*/
 void config_read(const char *name);
@@ -18,19 +18,60 @@
 /*- Includes ----------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "soc.h"
 #include "core.h"
 #include "main.h"
 #include "utils.h"
+#include "trace.h"
+#ifdef USE_JIT
+#include <stddef.h>
+#include "jit.h"
+#endif
+#ifdef USE_AOT
+#include <dlfcn.h>
+#endif
 
 /*- Definitions -------------------------------------------------------------*/
 #define DETECT_FLASH_WRITES
 
+#if defined(USE_AOT) && !defined(DETECT_FLASH_WRITES)
+#error Translated images require flash writes to be disabled
+#endif
+
 #define HASH_TABLE_SIZE        0x10000  // 64k
 #define ARRAY_SIZE(a)          (sizeof(a) / sizeof(a[0]))
 #define GET_PC(core)           (((core)->r[15] & ~1) - 2)
+#define MAP_INDEX(addr)        ((((addr) >> CORE_PAGE_BITS) ^ ((addr) >> 25)) & (CORE_MAP_SIZE - 1))
+#define BLOCK_INVALID          0xffffffff
+#define RUN_MIN_SIZE           4
+#define RUN_BACKOFF            255
+#define PARK_THRESHOLD         16
+#define AHEAD_MIN_SIZE         8
+#define AHEAD_BACKOFF          255
+#define DELAY_MIN              4
+#define DELAY_LIMIT            (1 << 24) // Maximum number of cycles to skip at once
+#define FUSE_MAX               3 // Longest fused instruction sequence
+
+#ifdef USE_STATS
+#define STATS_UNDEFINED        (CORE_STATS_INSTR - 1)
+#define STATS_OPCODES          32 // Number of the most frequent opcodes to report
+#define STATS_EXEC(core, d, n) core_stats_exec(core, d, n)
+#define STATS_NAME(name)       name
+#else
+#define STATS_EXEC(core, d, n)
+#define STATS_NAME(name)
+#endif
+
+#ifdef USE_JIT
+#define JIT_THRESHOLD          32
+#define JIT_R(i)               (int)(offsetof(core_t, r) + (i) * sizeof(uint32_t))
+#define JIT_F(f)               (int)offsetof(core_t, f)
+#define JIT_X(f)               (int)offsetof(core_ext_t, f)
+#endif
 
 #define SP     13
 #define LR     14
@@ -96,124 +137,586 @@
 #define GET32_J2(x)        (((x) >> 11) & 1)
 
 /*- Types -------------------------------------------------------------------*/
-typedef void (handler_t)(core_t *);
+enum
+{
+  FMT_NONE,
+  FMT_R1_R2,         // r1 = GET_R1(), r2 = GET_R2()
+  FMT_R1_R2_R3,      // r1 = GET_R1(), r2 = GET_R2(), r3 = GET_R3()
+  FMT_R1_R2_IMM3,    // r1 = GET_R1(), r2 = GET_R2(), imm = GET_IMM3()
+  FMT_R1_R2_IMM5,    // r1 = GET_R1(), r2 = GET_R2(), imm = GET_IMM5()
+  FMT_R1_R2_IMM5_H,  // r1 = GET_R1(), r2 = GET_R2(), imm = GET_IMM5() * 2
+  FMT_R1_R2_IMM5_W,  // r1 = GET_R1(), r2 = GET_R2(), imm = GET_IMM5() * 4
+  FMT_R1_4_R2_4,     // r1 = GET_R1_4(), r2 = GET_R2_4()
+  FMT_RD_IMM8,       // r1 = GET_R_IMM8(), imm = GET_IMM8()
+  FMT_RD_IMM8_W,     // r1 = GET_R_IMM8(), imm = GET_IMM8() * 4
+  FMT_IMM7_W,        // imm = GET_IMM7() * 4
+  FMT_LIST,          // r1 = GET_EXTRA_REG(), imm = GET_IMM8()
+  FMT_COND_IMM8,     // r1 = GET_COND(), imm = branch offset
+  FMT_IMM11,         // imm = branch offset
+  FMT_32BIT,         // decoded through instructions_32bit[]
+
+  FMT32_BL,          // imm = branch offset
+  FMT32_RD_IMM8,     // r1 = GET32_RD(), imm = GET32_IMM8()
+  FMT32_RA_IMM8,     // r1 = GET32_RA(), imm = GET32_IMM8()
+  FMT32_IMM16,       // imm = GET32_IMM16()
+  FMT32_IMM4,        // imm = GET32_IMM4()
+};
+
+enum
+{
+  EXEC_ANY,          // May be executed anywhere in a block run
+  EXEC_BRANCH,       // Ends a block
+  EXEC_BX,           // Ends a block, may return from an exception
+  EXEC_FIRST,        // Must be the first instruction of a block run
+  EXEC_ALONE,        // Must be the only instruction of a block run
+  EXEC_MEM_REG,      // Memory access at r2 + r3
+  EXEC_MEM_IMM,      // Memory access at r2 + imm
+  EXEC_MEM_SP,       // Memory access at SP + imm
+  EXEC_MEM_PC,       // Memory access at PC + imm
+  EXEC_MEM_LIST,     // Memory access of r3 words at r1
+  EXEC_PUSH,         // Memory access of r3 words below SP
+  EXEC_POP,          // Memory access of r3 words at SP, ends a block if r1
+};
+
+typedef struct decoded_t decoded_t;
+
+typedef void (handler_t)(core_t *, decoded_t *);
+
+// Superinstruction, executes d[0] and possibly d[1]. Returns the number of
+// executed instructions.
+typedef int (fused_t)(core_t *, decoded_t *);
+
+struct decoded_t
+{
+  handler_t    *handler;
+  uint32_t     imm;
+  uint8_t      r1;
+  uint8_t      r2;
+  uint8_t      r3;
+  uint8_t      exec;
+#ifdef USE_STATS
+  uint8_t      index;    // Instruction table entry
+  uint16_t     opcode;
+#endif
+};
 
 typedef struct
 {
   handler_t    *handler;
   uint16_t     mask;
   uint16_t     value;
+  int          format;
+  int          exec;
+#ifdef USE_STATS
+  const char   *name;
+#endif
 } instr_t;
 
+typedef struct
+{
+  handler_t    *handler;
+  uint32_t     mask;
+  uint32_t     value;
+  int          format;
+  int          exec;
+#ifdef USE_STATS
+  const char   *name;
+#endif
+} instr32_t;
+
+// Native code for a block, generated ahead of time by aot/aot.c. It executes
+// instructions 1 to count-1 and returns the number of executed instructions.
+typedef struct
+{
+  uint32_t     addr;
+  int          count;
+  int          (*run)(core_t *core);
+} aot_block_t;
+
+// Counted loop that only changes one register, like a delay loop. The loop
+// ends with a conditional branch back to the start, the condition is set by
+// the last instruction that is not a NOP, comparing reg with reg_or_imm.
+typedef struct
+{
+  int          reg;
+  uint32_t     step;     // Change of reg in one iteration
+  uint32_t     pre;      // Change of reg before the compare
+  int          cmp;      // Index of the compare instruction
+  int          cond;
+  int          fixed;    // Register compared with reg, -1 for imm
+  uint32_t     imm;
+  bool         swap;     // reg is the second operand
+  bool         add;      // Compared to zero after an addition
+} delay_t;
+
+typedef struct block_t
+{
+  uint32_t     addr;
+  uint32_t     size;
+  struct block_t *next[2];
+  int          count;
+  bool         ends;
+  bool         halt;
+  fused_t      **fused;
+  delay_t      *delay;
+#ifdef USE_JIT
+  int          heat;
+#endif
+#if defined(USE_JIT) || defined(USE_AOT)
+  int          (*native)(core_t *core);
+#endif
+  decoded_t    code[];
+} block_t;
+
+// Routine replaced by native code. The original first instruction is kept
+// for the calls the native code declines.
+typedef struct
+{
+  uint32_t     addr;
+  core_hook_t  *hook;
+  decoded_t    decoded;
+} hook_t;
+
+typedef struct image_t
+{
+  struct image_t *next;
+  uint32_t     size;
+  uint16_t     *flash;
+  decoded_t    *decoded;
+  block_t      **blocks;
+  uint8_t      *backoff;
+  uint8_t      *poll;
+  hook_t       *hooks;
+  int          hooks_count;
+  int          thread;   // Images are only shared by the cores of one thread
+#ifdef USE_AOT
+  const aot_block_t *aot;
+  int          aot_count;
+#endif
+} image_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+static void core_block_fuse(block_t *block, handler_t **handlers);
+static delay_t *core_delay_build(block_t *block, handler_t **handlers);
+#ifndef DETECT_FLASH_WRITES
+static void core_flash_write(core_t *core, uint32_t addr);
+#endif
+
 /*- Variables ---------------------------------------------------------------*/
-static handler_t *hash[HASH_TABLE_SIZE];
+static const instr_t *hash[HASH_TABLE_SIZE];
+static image_t *images = NULL;
+static core_t *pool = NULL;
+static int pool_used = CORE_POOL_SIZE;
+#ifdef USE_STATS
+static core_stats_t stats_total;
+static uint64_t stats_opcodes[HASH_TABLE_SIZE];
+#endif
 
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
-static inline uint8_t read_b(core_t *core, uint32_t addr)
+static inline void core_log_write(core_t *core, uint32_t addr)
+{
+  addr &= ~3;
+
+  core->ext->undo_addr[core->undo_count] = addr;
+  core->ext->undo_data[core->undo_count] = ((uint32_t *)core->ram)[addr >> 2];
+  core->undo_count++;
+}
+
+//-----------------------------------------------------------------------------
+static core_page_t *core_page_fill(core_t *core, core_page_t *region, uint32_t addr)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = (addr - region->addr) & ~(CORE_PAGE_SIZE - 1);
+
+  page->addr = region->addr + offset;
+  page->size = min(region->size - offset, (uint32_t)CORE_PAGE_SIZE);
+  page->wsize = region->wsize ? page->size : 0;
+  page->mem = region->mem + offset;
+
+  return page;
+}
+
+//-----------------------------------------------------------------------------
+static core_page_t *core_page_find(core_t *core, uint32_t addr)
+{
+  for (int i = 0; i < core->ext->regions_count; i++)
+  {
+    core_page_t *region = &core->ext->regions[i];
+
+    if ((addr - region->addr) < region->size)
+      return core_page_fill(core, region, addr);
+  }
+
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+static uint8_t core_read_b(core_t *core, uint32_t addr)
 {
-  if (addr < CORE_RAM_SIZE)
-    return ((uint8_t *)core->ram)[addr];
+  core_page_t *page = core_page_find(core, addr);
+
+  if (page)
+    return page->mem[addr - page->addr];
   else
     return soc_read_b((soc_t *)core->soc, addr);
 }
 
 //-----------------------------------------------------------------------------
-static inline uint16_t read_h(core_t *core, uint32_t addr)
+static uint16_t core_read_h(core_t *core, uint32_t addr)
 {
-  if (addr < CORE_RAM_SIZE)
-    return ((uint16_t *)core->ram)[addr >> 1];
+  core_page_t *page = core_page_find(core, addr);
+
+  if (page)
+    return ((uint16_t *)page->mem)[(addr - page->addr) >> 1];
   else
     return soc_read_h((soc_t *)core->soc, addr);
 }
 
 //-----------------------------------------------------------------------------
-static inline uint32_t read_w(core_t *core, uint32_t addr)
+static uint32_t core_read_w(core_t *core, uint32_t addr)
 {
-  if (addr < CORE_RAM_SIZE)
-    return ((uint32_t *)core->ram)[addr >> 2];
+  core_page_t *page = core_page_find(core, addr);
+
+  if (page)
+    return ((uint32_t *)page->mem)[(addr - page->addr) >> 2];
   else
     return soc_read_w((soc_t *)core->soc, addr);
 }
 
 //-----------------------------------------------------------------------------
-static inline void write_b(core_t *core, uint32_t addr, uint8_t data)
+static inline uint8_t read_b(core_t *core, uint32_t addr)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->size)
+    return page->mem[offset];
+  else
+    return core_read_b(core, addr);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint16_t read_h(core_t *core, uint32_t addr)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->size)
+    return ((uint16_t *)page->mem)[offset >> 1];
+  else
+    return core_read_h(core, addr);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t read_w(core_t *core, uint32_t addr)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->size)
+    return ((uint32_t *)page->mem)[offset >> 2];
+  else
+    return core_read_w(core, addr);
+}
+
+//-----------------------------------------------------------------------------
+static void core_write_b(core_t *core, uint32_t addr, uint8_t data)
 {
+  core_page_t *page;
+
 #ifdef DETECT_FLASH_WRITES
-  if (addr < CORE_FLASH_SIZE)
+  if (addr < core->flash_size)
   {
     error("%s: 0x%08x: byte write into the flash area @ 0x%08x = 0x%02x",
         core->name, GET_PC(core), addr, data);
   }
-#endif
+#else
+  if (addr < core->flash_size)
+  {
+    core_flash_write(core, addr);
 
-  if (addr < CORE_RAM_SIZE)
+    if (core->logging)
+      core_log_write(core, addr);
     ((uint8_t *)core->ram)[addr] = data;
+  }
+#endif
+  else if ((page = core_page_find(core, addr)) && page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    ((uint8_t *)page->mem)[(addr - page->addr)] = data;
+  }
   else
     soc_write_b((soc_t *)core->soc, addr, data);
 }
 
 //-----------------------------------------------------------------------------
-static inline void write_h(core_t *core, uint32_t addr, uint16_t data)
+static void core_write_h(core_t *core, uint32_t addr, uint16_t data)
 {
+  core_page_t *page;
+
 #ifdef DETECT_FLASH_WRITES
-  if (addr < CORE_FLASH_SIZE)
+  if (addr < core->flash_size)
   {
     error("%s: 0x%08x: half write into the flash area @ 0x%08x = 0x%04x",
         core->name, GET_PC(core), addr, data);
   }
-#endif
+#else
+  if (addr < core->flash_size)
+  {
+    core_flash_write(core, addr);
 
-  if (addr < CORE_RAM_SIZE)
+    if (core->logging)
+      core_log_write(core, addr);
     ((uint16_t *)core->ram)[addr >> 1] = data;
+  }
+#endif
+  else if ((page = core_page_find(core, addr)) && page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    ((uint16_t *)page->mem)[(addr - page->addr) >> 1] = data;
+  }
   else
     soc_write_h((soc_t *)core->soc, addr, data);
 }
 
 //-----------------------------------------------------------------------------
-static inline void write_w(core_t *core, uint32_t addr, uint32_t data)
+static void core_write_w(core_t *core, uint32_t addr, uint32_t data)
 {
+  core_page_t *page;
+
 #ifdef DETECT_FLASH_WRITES
-  if (addr < CORE_FLASH_SIZE)
+  if (addr < core->flash_size)
   {
     error("%s: 0x%08x: word write into the flash area @ 0x%08x = 0x%08x",
         core->name, GET_PC(core), addr, data);
   }
-#endif
+#else
+  if (addr < core->flash_size)
+  {
+    core_flash_write(core, addr);
 
-  if (addr < CORE_RAM_SIZE)
+    if (core->logging)
+      core_log_write(core, addr);
     ((uint32_t *)core->ram)[addr >> 2] = data;
+  }
+#endif
+  else if ((page = core_page_find(core, addr)) && page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    ((uint32_t *)page->mem)[(addr - page->addr) >> 2] = data;
+  }
   else
     soc_write_w((soc_t *)core->soc, addr, data);
 }
 
+//-----------------------------------------------------------------------------
+static inline void write_b(core_t *core, uint32_t addr, uint8_t data)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    page->mem[offset] = data;
+  }
+  else
+    core_write_b(core, addr, data);
+}
+
+//-----------------------------------------------------------------------------
+static inline void write_h(core_t *core, uint32_t addr, uint16_t data)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    ((uint16_t *)page->mem)[offset >> 1] = data;
+  }
+  else
+    core_write_h(core, addr, data);
+}
+
+//-----------------------------------------------------------------------------
+static inline void write_w(core_t *core, uint32_t addr, uint32_t data)
+{
+  core_page_t *page = &core->ext->map[MAP_INDEX(addr)];
+  uint32_t offset = addr - page->addr;
+
+  if (offset < page->wsize)
+  {
+    if (core->logging)
+      core_log_write(core, addr);
+    ((uint32_t *)page->mem)[offset >> 2] = data;
+  }
+  else
+    core_write_w(core, addr, data);
+}
+
+//-----------------------------------------------------------------------------
+static inline bool overflow(uint32_t a, uint32_t b, uint32_t r)
+{
+  return ((a ^ b ^ 0x80000000UL) & (a ^ r)) >> 31;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool carry(uint32_t a, bool c, uint32_t r)
+{
+  return c ? r <= a : r < a;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool flag_n(core_t *core)
+{
+  return core->flags.nz < 0;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool flag_z(core_t *core)
+{
+  return 0 == (uint32_t)core->flags.nz;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool flag_c(core_t *core)
+{
+  flags_t *f = &core->flags;
+
+  if (f->lazy)
+    return carry(f->a, f->carry, f->a + f->b + f->carry);
+
+  return f->c;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool flag_v(core_t *core)
+{
+  flags_t *f = &core->flags;
+
+  if (f->lazy)
+    return overflow(f->a, f->b, f->a + f->b + f->carry);
+
+  return f->v;
+}
+
+//-----------------------------------------------------------------------------
+static inline void set_nz(core_t *core, uint32_t res)
+{
+  core->flags.nz = (int32_t)res;
+}
+
+//-----------------------------------------------------------------------------
+static inline void set_add(core_t *core, uint32_t a, uint32_t b, bool c)
+{
+  core->flags.a = a;
+  core->flags.b = b;
+  core->flags.carry = c;
+  core->flags.lazy = true;
+}
+
+//-----------------------------------------------------------------------------
+static inline void set_c(core_t *core, bool c)
+{
+  if (core->flags.lazy)
+  {
+    core->flags.v = flag_v(core);
+    core->flags.lazy = false;
+  }
+
+  core->flags.c = c;
+}
+
+//-----------------------------------------------------------------------------
+static inline void set_flags(core_t *core, bool n, bool z, bool c, bool v)
+{
+  // N and Z are both set only by the explicit writes, the sign of the
+  // 64-bit value keeps N independent of the low word
+  core->flags.nz = n ? (z ? INT64_MIN : -1) : (z ? 0 : 1);
+  core->flags.lazy = false;
+  core->flags.c = c;
+  core->flags.v = v;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool core_frame_in_ram(core_t *core, uint32_t frameptr)
+{
+  return 0 == (frameptr & 3) && frameptr >= core->flash_size &&
+      frameptr <= (core->mem_size - 0x20);
+}
+
 //-----------------------------------------------------------------------------
 static void core_exception_enter(core_t *core)
 {
   uint32_t *ram = (uint32_t *)core->ram;
-  uint32_t frameptr, align, number, xpsr;
+  uint32_t frameptr, align, xpsr;
+  uint32_t pending = core->irqs & core->irq_en;
 
-  for (number = 0; number < 32; number++)
-    if (core->irqs & (1 << number))
-      break;
+  // SysTick has the lowest exception number, so it goes first. Its pending
+  // state is cleared on entry, peripheral interrupts stay pending until
+  // cleared by the handler.
+  if (pending & (1u << CORE_IRQ_SYS_TICK))
+  {
+    core->ipsr = 15;
+    core->irqs &= ~(1u << CORE_IRQ_SYS_TICK);
+  }
+  else
+  {
+    core->ipsr = 16 + __builtin_ctz(pending);
+  }
+
+  core->ext->event = true;
+  CORE_STATS(core, exceptions);
+
+  // A tail-chained exception reuses the frame of the previous one
+  if (core->chained)
+  {
+    CORE_STATS(core, chained);
+    core->chained = false;
+    core->r[LR] = 0xfffffff9;
+    core->r[PC] = ram[core->ipsr] & 0xfffffffe;
+    return;
+  }
 
   align = (core->r[SP] >> 2) & 1;
-  core->ipsr = 16 + number;
-  xpsr = (core->n << BIT_N) | (core->z << BIT_Z) | (core->c << BIT_C) |
-      (core->v << BIT_V) | (1 << BIT_T) | (align << BIT_A) | core->ipsr;
+  xpsr = (flag_n(core) << BIT_N) | (flag_z(core) << BIT_Z) | (flag_c(core) << BIT_C) |
+      (flag_v(core) << BIT_V) | (1 << BIT_T) | (align << BIT_A) | core->ipsr;
 
   core->r[SP] = (core->r[SP] - 0x20) & 0xfffffffb;
   frameptr = core->r[SP];
 
-  write_w(core, frameptr + 0x00, core->r[0]);
-  write_w(core, frameptr + 0x04, core->r[1]);
-  write_w(core, frameptr + 0x08, core->r[2]);
-  write_w(core, frameptr + 0x0c, core->r[3]);
-  write_w(core, frameptr + 0x10, core->r[12]);
-  write_w(core, frameptr + 0x14, core->r[LR]);
-  write_w(core, frameptr + 0x18, core->r[PC]);
-  write_w(core, frameptr + 0x1c, xpsr);
+  if (core_frame_in_ram(core, frameptr))
+  {
+    uint32_t *frame = &ram[frameptr >> 2];
+
+    frame[0] = core->r[0];
+    frame[1] = core->r[1];
+    frame[2] = core->r[2];
+    frame[3] = core->r[3];
+    frame[4] = core->r[12];
+    frame[5] = core->r[LR];
+    frame[6] = core->r[PC];
+    frame[7] = xpsr;
+  }
+  else
+  {
+    write_w(core, frameptr + 0x00, core->r[0]);
+    write_w(core, frameptr + 0x04, core->r[1]);
+    write_w(core, frameptr + 0x08, core->r[2]);
+    write_w(core, frameptr + 0x0c, core->r[3]);
+    write_w(core, frameptr + 0x10, core->r[12]);
+    write_w(core, frameptr + 0x14, core->r[LR]);
+    write_w(core, frameptr + 0x18, core->r[PC]);
+    write_w(core, frameptr + 0x1c, xpsr);
+  }
 
   core->r[LR] = 0xfffffff9;
   core->r[PC] = ram[core->ipsr] & 0xfffffffe;
@@ -224,53 +727,76 @@ static void core_exception_return(core_t *core)
 {
   uint32_t frameptr, xpsr, align;
 
+  core->ipsr = 0;
+  core->ext->event = true;
+
+  // Another interrupt is pending, the frame stays on the stack for it.
+  // Interrupts are only cleared by the core itself, so the exception is
+  // taken on the next cycle.
+  if ((core->irqs & core->irq_en) && core->pm)
+  {
+    core->chained = true;
+    return;
+  }
+
   frameptr = core->r[SP];
 
-  core->r[0] = read_w(core, frameptr + 0x00);
-  core->r[1] = read_w(core, frameptr + 0x04);
-  core->r[2] = read_w(core, frameptr + 0x08);
-  core->r[3] = read_w(core, frameptr + 0x0c);
-  core->r[12] = read_w(core, frameptr + 0x10);
-  core->r[LR] = read_w(core, frameptr + 0x14);
-  core->r[PC] = read_w(core, frameptr + 0x18);
-  xpsr = read_w(core, frameptr + 0x1c);
+  if (core_frame_in_ram(core, frameptr))
+  {
+    uint32_t *frame = &((uint32_t *)core->ram)[frameptr >> 2];
+
+    core->r[0] = frame[0];
+    core->r[1] = frame[1];
+    core->r[2] = frame[2];
+    core->r[3] = frame[3];
+    core->r[12] = frame[4];
+    core->r[LR] = frame[5];
+    core->r[PC] = frame[6];
+    xpsr = frame[7];
+  }
+  else
+  {
+    core->r[0] = read_w(core, frameptr + 0x00);
+    core->r[1] = read_w(core, frameptr + 0x04);
+    core->r[2] = read_w(core, frameptr + 0x08);
+    core->r[3] = read_w(core, frameptr + 0x0c);
+    core->r[12] = read_w(core, frameptr + 0x10);
+    core->r[LR] = read_w(core, frameptr + 0x14);
+    core->r[PC] = read_w(core, frameptr + 0x18);
+    xpsr = read_w(core, frameptr + 0x1c);
+  }
 
   align = (xpsr >> BIT_A) & 1;
   core->r[SP] = (core->r[SP] + 0x20) | (align << 2);
 
-  core->n = (xpsr & (1 << BIT_N)) > 0;
-  core->z = (xpsr & (1 << BIT_Z)) > 0;
-  core->c = (xpsr & (1 << BIT_C)) > 0;
-  core->v = (xpsr & (1 << BIT_V)) > 0;
+  set_flags(core, (xpsr & (1 << BIT_N)) > 0, (xpsr & (1 << BIT_Z)) > 0,
+      (xpsr & (1 << BIT_C)) > 0, (xpsr & (1 << BIT_V)) > 0);
 
-  core->ipsr = 0;
-}
-
-//-----------------------------------------------------------------------------
-static inline bool overflow(uint32_t a, uint32_t b, uint32_t r)
-{
-  return ((a ^ b ^ 0x80000000UL) & (a ^ r)) >> 31;
+  // The thread state is restored, but the core goes back to sleep without
+  // executing it. The frame is pushed again when the next interrupt arrives.
+  if (core->ext->sleep_on_exit)
+  {
+    queue_remove(&g_part->active, core);
+    queue_add(&g_part->sleeping, core);
+    core->sleeping = true;
+  }
 }
 
 //-----------------------------------------------------------------------------
-static inline bool carry(uint32_t a, bool c, uint32_t r)
+static void i_undefined(core_t *core, decoded_t *d)
 {
-  return c ? r <= a : r < a;
-}
+  (void)d;
 
-//-----------------------------------------------------------------------------
-static void i_undefined(core_t *core)
-{
-  error("%s: undefined instruction 0x%04x at 0x%08x", core->name, core->opcode,
-      core->r[PC]-2);
+  error("%s: undefined instruction 0x%04x at 0x%08x", core->name,
+      core->flash[(core->r[PC]-2) >> 1], core->r[PC]-2);
 }
 
 //-----------------------------------------------------------------------------
-static void i_lsls_imm(core_t *core)
+static void i_lsls_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -283,21 +809,20 @@ static void i_lsls_imm(core_t *core)
   else
   {
     res = r2v << imm;
-    core->c = (r2v >> (32-imm)) & 1;
+    set_c(core, (r2v >> (32-imm)) & 1);
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_lsrs_imm(core_t *core)
+static void i_lsrs_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -309,26 +834,25 @@ static void i_lsrs_imm(core_t *core)
   if (imm < 32)
   {
     res = r2v >> imm;
-    core->c = (r2v >> (imm-1)) & 1;
+    set_c(core, (r2v >> (imm-1)) & 1);
   }
   else
   {
     res = 0;
-    core->c = (r2v >> 31) & 1;
+    set_c(core, (r2v >> 31) & 1);
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_asrs_imm(core_t *core)
+static void i_asrs_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -340,34 +864,33 @@ static void i_asrs_imm(core_t *core)
   if (imm < 32)
   {
     res = (int32_t)r2v >> imm;
-    core->c = (r2v >> (imm-1)) & 1;
+    set_c(core, (r2v >> (imm-1)) & 1);
   }
   else
   {
     if (r2v & 0x80000000)
     {
       res = 0xffffffff;
-      core->c = true;
+      set_c(core, true);
     }
     else
     {
       res = 0;
-      core->c = false;
+      set_c(core, false);
     }
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_adds_reg(core_t *core)
+static void i_adds_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
   uint32_t r2v = core->r[r2];
   uint32_t r3v = core->r[r3];
   uint32_t res;
@@ -376,20 +899,18 @@ static void i_adds_reg(core_t *core)
 
   res = r2v + r3v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r2v, false, res);
-  core->v = overflow(r2v, r3v, res);
+  set_nz(core, res);
+  set_add(core, r2v, r3v, false);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_subs_reg(core_t *core)
+static void i_subs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
   uint32_t r2v = core->r[r2];
   uint32_t r3v = core->r[r3];
   uint32_t res;
@@ -398,20 +919,18 @@ static void i_subs_reg(core_t *core)
 
   res = r2v + ~r3v + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r2v, true, res);
-  core->v = overflow(r2v, ~r3v, res);
+  set_nz(core, res);
+  set_add(core, r2v, ~r3v, true);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_adds_imm3(core_t *core)
+static void i_adds_imm3(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -419,20 +938,18 @@ static void i_adds_imm3(core_t *core)
 
   res = r2v + imm;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r2v, false, res);
-  core->v = overflow(r2v, imm, res);
+  set_nz(core, res);
+  set_add(core, r2v, imm, false);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_subs_imm3(core_t *core)
+static void i_subs_imm3(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -440,34 +957,31 @@ static void i_subs_imm3(core_t *core)
 
   res = r2v + ~imm + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r2v, true, res);
-  core->v = overflow(r2v, ~imm, res);
+  set_nz(core, res);
+  set_add(core, r2v, ~imm, true);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_movs_imm(core_t *core)
+static void i_movs_imm(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode);
+  int rd = d->r1;
+  uint32_t imm = d->imm;
   uint32_t res = imm;
 
   CORE_DBG(core, "movs\tr%d, 0x%02x", rd, imm);
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[rd] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_cmp_imm(core_t *core)
+static void i_cmp_imm(core_t *core, decoded_t *d)
 {
-  int r = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode);
+  int r = d->r1;
+  uint32_t imm = d->imm;
   uint32_t rv = core->r[r];
   uint32_t res;
 
@@ -475,17 +989,15 @@ static void i_cmp_imm(core_t *core)
 
   res = rv + ~imm + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(rv, true, res);
-  core->v = overflow(rv, ~imm, res);
+  set_nz(core, res);
+  set_add(core, rv, ~imm, true);
 }
 
 //-----------------------------------------------------------------------------
-static void i_adds_imm8(core_t *core)
+static void i_adds_imm8(core_t *core, decoded_t *d)
 {
-  int r = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode);
+  int r = d->r1;
+  uint32_t imm = d->imm;
   uint32_t rv = core->r[r];
   uint32_t res;
 
@@ -493,19 +1005,17 @@ static void i_adds_imm8(core_t *core)
 
   res = rv + imm;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(rv, false, res);
-  core->v = overflow(rv, imm, res);
+  set_nz(core, res);
+  set_add(core, rv, imm, false);
 
   core->r[r] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_subs_imm8(core_t *core)
+static void i_subs_imm8(core_t *core, decoded_t *d)
 {
-  int r = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode);
+  int r = d->r1;
+  uint32_t imm = d->imm;
   uint32_t rv = core->r[r];
   uint32_t res;
 
@@ -513,19 +1023,17 @@ static void i_subs_imm8(core_t *core)
 
   res = rv + ~imm + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(rv, true, res);
-  core->v = overflow(rv, ~imm, res);
+  set_nz(core, res);
+  set_add(core, rv, ~imm, true);
 
   core->r[r] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_ands_reg(core_t *core)
+static void i_ands_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -534,17 +1042,16 @@ static void i_ands_reg(core_t *core)
 
   res = r1v & r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_eors_reg(core_t *core)
+static void i_eors_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -553,17 +1060,16 @@ static void i_eors_reg(core_t *core)
 
   res = r1v ^ r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_lsls_reg(core_t *core)
+static void i_lsls_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2] & 0xff;
   uint32_t res;
@@ -577,30 +1083,29 @@ static void i_lsls_reg(core_t *core)
   else if (r2v < 32)
   {
     res = r1v << r2v;
-    core->c = (r1v >> (32-r2v)) & 1;
+    set_c(core, (r1v >> (32-r2v)) & 1);
   }
   else if (r2v == 32)
   {
     res = 0;
-    core->c = r1v & 1;
+    set_c(core, r1v & 1);
   }
   else
   {
     res = 0;
-    core->c = false;
+    set_c(core, false);
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_lsrs_reg(core_t *core)
+static void i_lsrs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2] & 0xff;
   uint32_t res;
@@ -614,30 +1119,29 @@ static void i_lsrs_reg(core_t *core)
   else if (r2v < 32)
   {
     res = r1v >> r2v;
-    core->c = (r1v >> (r2v-1)) & 1;
+    set_c(core, (r1v >> (r2v-1)) & 1);
   }
   else if (r2v == 32)
   {
     res = 0;
-    core->c = r1v >> 31;
+    set_c(core, r1v >> 31);
   }
   else
   {
     res = 0;
-    core->c = false;
+    set_c(core, false);
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_asrs_reg(core_t *core)
+static void i_asrs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2] & 0xff;
   uint32_t res;
@@ -651,75 +1155,72 @@ static void i_asrs_reg(core_t *core)
   else if (r2v < 32)
   {
     res = (int32_t)r1v >> r2v;
-    core->c = (r1v >> (r2v-1)) & 1;
+    set_c(core, (r1v >> (r2v-1)) & 1);
   }
   else
   {
     if (r1v & 0x80000000)
     {
       res = 0xffffffff;
-      core->c = true;
+      set_c(core, true);
     }
     else
     {
       res = 0;
-      core->c = false;
+      set_c(core, false);
     }
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_adcs_reg(core_t *core)
+static void i_adcs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
+  bool c = flag_c(core);
   uint32_t res;
 
   CORE_DBG(core, "adcs\tr%d, r%d", r1, r2);
 
-  res = r1v + r2v + core->c;
+  res = r1v + r2v + c;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r1v, core->c, res);
-  core->v = overflow(r1v, r2v, res);
+  set_nz(core, res);
+  set_add(core, r1v, r2v, c);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_sbcs_reg(core_t *core)
+static void i_sbcs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
+  bool c = flag_c(core);
   uint32_t res;
 
   CORE_DBG(core, "sbcs\tr%d, r%d", r1, r2);
 
-  res = r1v + ~r2v + core->c;
+  res = r1v + ~r2v + c;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r1v, core->c, res);
-  core->v = overflow(r1v, ~r2v, res);
+  set_nz(core, res);
+  set_add(core, r1v, ~r2v, c);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_rors_reg(core_t *core)
+static void i_rors_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2] & 0xff;
   uint32_t res = r1v;
@@ -733,25 +1234,24 @@ static void i_rors_reg(core_t *core)
     if (r2v > 0)
     {
       res = (r1v >> r2v) | (r1v << (32-r2v));
-      core->c = (r1v >> (r2v-1)) & 1;
+      set_c(core, (r1v >> (r2v-1)) & 1);
     }
     else
     {
-      core->c = r1v >> 31;
+      set_c(core, r1v >> 31);
     }
   }
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_tst_reg(core_t *core)
+static void i_tst_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -760,15 +1260,14 @@ static void i_tst_reg(core_t *core)
 
   res = r1v & r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 }
 
 //-----------------------------------------------------------------------------
-static void i_rsbs_imm(core_t *core)
+static void i_rsbs_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -776,19 +1275,17 @@ static void i_rsbs_imm(core_t *core)
 
   res = ~r2v + 0 + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(~r2v, true, res);
-  core->v = overflow(~r2v, 0, res);
+  set_nz(core, res);
+  set_add(core, ~r2v, 0, true);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_cmp_reg(core_t *core)
+static void i_cmp_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -797,17 +1294,15 @@ static void i_cmp_reg(core_t *core)
 
   res = r1v + ~r2v + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r1v, true, res);
-  core->v = overflow(r1v, ~r2v, res);
+  set_nz(core, res);
+  set_add(core, r1v, ~r2v, true);
 }
 
 //-----------------------------------------------------------------------------
-static void i_cmn_reg(core_t *core)
+static void i_cmn_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -816,17 +1311,15 @@ static void i_cmn_reg(core_t *core)
 
   res = r1v + r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r1v, false, res);
-  core->v = overflow(r1v, r2v, res);
+  set_nz(core, res);
+  set_add(core, r1v, r2v, false);
 }
 
 //-----------------------------------------------------------------------------
-static void i_orrs_reg(core_t *core)
+static void i_orrs_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -835,34 +1328,32 @@ static void i_orrs_reg(core_t *core)
 
   res = r1v | r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_muls_reg(core_t *core)
+static void i_muls_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t res;
 
   CORE_DBG(core, "muls\tr%d, r%d, r%d", r1, r2, r1);
 
   res = core->r[r1] * core->r[r2];
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_bics_reg(core_t *core)
+static void i_bics_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -871,17 +1362,16 @@ static void i_bics_reg(core_t *core)
 
   res = r1v & ~r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_mvns_reg(core_t *core)
+static void i_mvns_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
   uint32_t res;
 
@@ -889,17 +1379,16 @@ static void i_mvns_reg(core_t *core)
 
   res = ~r2v;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
+  set_nz(core, res);
 
   core->r[r1] = res;
 }
 
 //-----------------------------------------------------------------------------
-static void i_add_reg4(core_t *core)
+static void i_add_reg4(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1_4(core->opcode);
-  int r2 = GET_R2_4(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
 
   CORE_DBG(core, "add\tr%d, r%d", r1, r2);
 
@@ -910,10 +1399,10 @@ static void i_add_reg4(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_cmp_reg4(core_t *core)
+static void i_cmp_reg4(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1_4(core->opcode);
-  int r2 = GET_R2_4(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r1v = core->r[r1];
   uint32_t r2v = core->r[r2];
   uint32_t res;
@@ -922,17 +1411,15 @@ static void i_cmp_reg4(core_t *core)
 
   res = r1v + ~r2v + 1;
 
-  core->n = (res >> 31);
-  core->z = res == 0;
-  core->c = carry(r1v, true, res);
-  core->v = overflow(r1v, ~r2v, res);
+  set_nz(core, res);
+  set_add(core, r1v, ~r2v, true);
 }
 
 //-----------------------------------------------------------------------------
-static void i_mov_reg4(core_t *core)
+static void i_mov_reg4(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1_4(core->opcode);
-  int r2 = GET_R2_4(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
 
   CORE_DBG(core, "mov\tr%d, r%d", r1, r2);
 
@@ -943,9 +1430,9 @@ static void i_mov_reg4(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_bx_reg4(core_t *core)
+static void i_bx_reg4(core_t *core, decoded_t *d)
 {
-  int r = GET_R2_4(core->opcode);
+  int r = d->r2;
 
   CORE_DBG(core, "bx\tr%d", r);
 
@@ -956,9 +1443,9 @@ static void i_bx_reg4(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_blx_reg4(core_t *core)
+static void i_blx_reg4(core_t *core, decoded_t *d)
 {
-  int r = GET_R2_4(core->opcode);
+  int r = d->r2;
   uint32_t addr;
 
   CORE_DBG(core, "blx\tr%d", r);
@@ -969,10 +1456,10 @@ static void i_blx_reg4(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldr_pc(core_t *core)
+static void i_ldr_pc(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 4;
+  int rd = d->r1;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "ldr\tr%d, [PC, 0x%02x]", rd, imm);
 
@@ -980,11 +1467,11 @@ static void i_ldr_pc(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_str_reg(core_t *core)
+static void i_str_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "str\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -992,11 +1479,11 @@ static void i_str_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_strh_reg(core_t *core)
+static void i_strh_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "strh\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -1004,11 +1491,11 @@ static void i_strh_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_strb_reg(core_t *core)
+static void i_strb_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "strb\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -1016,11 +1503,11 @@ static void i_strb_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrsb_reg(core_t *core)
+static void i_ldrsb_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
   uint32_t val;
 
   CORE_DBG(core, "ldrsb\tr%d, [r%d, r%d]", r1, r2, r3);
@@ -1030,11 +1517,11 @@ static void i_ldrsb_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldr_reg(core_t *core)
+static void i_ldr_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "ldr\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -1042,11 +1529,11 @@ static void i_ldr_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrh_reg(core_t *core)
+static void i_ldrh_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "ldrh\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -1054,11 +1541,11 @@ static void i_ldrh_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrb_reg(core_t *core)
+static void i_ldrb_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
 
   CORE_DBG(core, "ldrb\tr%d, [r%d, r%d]", r1, r2, r3);
 
@@ -1066,11 +1553,11 @@ static void i_ldrb_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrsh_reg(core_t *core)
+static void i_ldrsh_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  int r3 = GET_R3(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  int r3 = d->r3;
   uint32_t val;
 
   CORE_DBG(core, "ldrsh\tr%d, [r%d, r%d]", r1, r2, r3);
@@ -1080,11 +1567,11 @@ static void i_ldrsh_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_str_imm(core_t *core)
+static void i_str_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode) * 4;
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "str\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1092,11 +1579,11 @@ static void i_str_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldr_imm(core_t *core)
+static void i_ldr_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode) * 4;
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "ldr\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1104,11 +1591,11 @@ static void i_ldr_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_strb_imm(core_t *core)
+static void i_strb_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "strb\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1116,11 +1603,11 @@ static void i_strb_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrb_imm(core_t *core)
+static void i_ldrb_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "ldrb\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1128,11 +1615,11 @@ static void i_ldrb_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_strh_imm(core_t *core)
+static void i_strh_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode) * 2;
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "strh\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1140,11 +1627,11 @@ static void i_strh_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldrh_imm(core_t *core)
+static void i_ldrh_imm(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
-  uint32_t imm = GET_IMM5(core->opcode) * 2;
+  int r1 = d->r1;
+  int r2 = d->r2;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "ldrh\tr%d, [r%d, 0x%02x]", r1, r2, imm);
 
@@ -1152,10 +1639,10 @@ static void i_ldrh_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_str_r_sp_imm(core_t *core)
+static void i_str_r_sp_imm(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 4;
+  int rd = d->r1;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "str\tr%d, [SP, 0x%02x]", rd, imm);
 
@@ -1163,10 +1650,10 @@ static void i_str_r_sp_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldr_r_sp_imm(core_t *core)
+static void i_ldr_r_sp_imm(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 4;
+  int rd = d->r1;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "ldr\tr%d, [SP, 0x%02x]", rd, imm);
 
@@ -1174,10 +1661,10 @@ static void i_ldr_r_sp_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_add_r_pc_imm(core_t *core)
+static void i_add_r_pc_imm(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 4;
+  int rd = d->r1;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "add\tr%d, PC, 0x%02x", rd, imm);
 
@@ -1185,10 +1672,10 @@ static void i_add_r_pc_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_add_r_sp_imm(core_t *core)
+static void i_add_r_sp_imm(core_t *core, decoded_t *d)
 {
-  int rd = GET_R_IMM8(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 4;
+  int rd = d->r1;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "add\tr%d, SP, 0x%02x", rd, imm);
 
@@ -1196,9 +1683,9 @@ static void i_add_r_sp_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_add_sp_imm(core_t *core)
+static void i_add_sp_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM7(core->opcode) * 4;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "add\tSP, SP, 0x%02x", imm);
 
@@ -1206,9 +1693,9 @@ static void i_add_sp_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_sub_sp_imm(core_t *core)
+static void i_sub_sp_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM7(core->opcode) * 4;
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "sub\tSP, SP, 0x%02x", imm);
 
@@ -1216,10 +1703,10 @@ static void i_sub_sp_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_sxth_reg(core_t *core)
+static void i_sxth_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
 
   CORE_DBG(core, "sxth\tr%d, r%d", r1, r2);
@@ -1228,10 +1715,10 @@ static void i_sxth_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_sxtb_reg(core_t *core)
+static void i_sxtb_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
 
   CORE_DBG(core, "sxtb\tr%d, r%d", r1, r2);
@@ -1240,10 +1727,10 @@ static void i_sxtb_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_uxth_reg(core_t *core)
+static void i_uxth_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
 
   CORE_DBG(core, "uxth\tr%d, r%d", r1, r2);
 
@@ -1251,10 +1738,10 @@ static void i_uxth_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_uxtb_reg(core_t *core)
+static void i_uxtb_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
 
   CORE_DBG(core, "uxtb\tr%d, r%d", r1, r2);
 
@@ -1262,10 +1749,10 @@ static void i_uxtb_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_push(core_t *core)
+static void i_push(core_t *core, decoded_t *d)
 {
-  int list = GET_IMM8(core->opcode);
-  int lr = GET_EXTRA_REG(core->opcode);
+  int list = d->imm;
+  int lr = d->r1;
   uint32_t addr;
 
   CORE_DBG(core, "push\t{%d, 0x%02x}", lr, list);
@@ -1291,10 +1778,10 @@ static void i_push(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_pop(core_t *core)
+static void i_pop(core_t *core, decoded_t *d)
 {
-  int list = GET_IMM8(core->opcode);
-  int pc = GET_EXTRA_REG(core->opcode);
+  int list = d->imm;
+  int pc = d->r1;
   uint32_t addr, pc_val;
 
   CORE_DBG(core, "pop\t{%d, 0x%02x}", pc, list);
@@ -1324,26 +1811,30 @@ static void i_pop(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_cpsie(core_t *core)
+static void i_cpsie(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "cpsie\ti");
 
   core->pm = true;
 }
 
 //-----------------------------------------------------------------------------
-static void i_cpsid(core_t *core)
+static void i_cpsid(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "cpsid\ti");
 
   core->pm = false;
 }
 
 //-----------------------------------------------------------------------------
-static void i_rev_reg(core_t *core)
+static void i_rev_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
 
   CORE_DBG(core, "rev\tr%d, r%d", r1, r2);
@@ -1353,10 +1844,10 @@ static void i_rev_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_rev16_reg(core_t *core)
+static void i_rev16_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
 
   CORE_DBG(core, "rev16\tr%d, r%d", r1, r2);
@@ -1366,10 +1857,10 @@ static void i_rev16_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_revsh_reg(core_t *core)
+static void i_revsh_reg(core_t *core, decoded_t *d)
 {
-  int r1 = GET_R1(core->opcode);
-  int r2 = GET_R2(core->opcode);
+  int r1 = d->r1;
+  int r2 = d->r2;
   uint32_t r2v = core->r[r2];
 
   CORE_DBG(core, "revsh\tr%d, r%d", r1, r2);
@@ -1379,53 +1870,77 @@ static void i_revsh_reg(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_bkpt_imm(core_t *core)
+static void i_bkpt_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM8(core->opcode);
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "bkpt\t0x%02x", imm);
 }
 
 //-----------------------------------------------------------------------------
-static void i_nop(core_t *core)
+static void i_nop(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "nop");
 }
 
 //-----------------------------------------------------------------------------
-static void i_yield(core_t *core)
+static void i_yield(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "yield");
 }
 
 //-----------------------------------------------------------------------------
-static void i_wfe(core_t *core)
+static void i_wfe(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "wfe");
+
+  // A pending event is consumed without sleeping. Otherwise the core sleeps
+  // like on WFI and any interrupt request wakes it up.
+  if (core->ext->event)
+  {
+    core->ext->event = false;
+    return;
+  }
+
+  queue_remove(&g_part->active, core);
+  queue_add(&g_part->sleeping, core);
+  core->sleeping = true;
 }
 
 //-----------------------------------------------------------------------------
-static void i_wfi(core_t *core)
+static void i_wfi(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "wfi");
 
-  soc_t *soc = SOC(core);
-  queue_remove(&g_sim.active, (queue_t *)soc);
-  queue_add(&g_sim.sleeping, (queue_t *)soc);
+  queue_remove(&g_part->active, core);
+  queue_add(&g_part->sleeping, core);
   core->sleeping = true;
 }
 
 //-----------------------------------------------------------------------------
-static void i_sev(core_t *core)
+static void i_sev(core_t *core, decoded_t *d)
 {
+  (void)d;
+
   CORE_DBG(core, "sev");
+
+  // Each node has a single core, so the event is only seen by this core
+  core->ext->event = true;
 }
 
 //-----------------------------------------------------------------------------
-static void i_stm(core_t *core)
+static void i_stm(core_t *core, decoded_t *d)
 {
-  int list = GET_IMM8(core->opcode);
-  int r = GET_R_IMM8(core->opcode);
+  int list = d->imm;
+  int r = d->r1;
   uint32_t addr;
 
   CORE_DBG(core, "stm\tr%d, {0x%02x}", r, list);
@@ -1445,10 +1960,10 @@ static void i_stm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_ldm(core_t *core)
+static void i_ldm(core_t *core, decoded_t *d)
 {
-  int list = GET_IMM8(core->opcode);
-  int r = GET_R_IMM8(core->opcode);
+  int list = d->imm;
+  int r = d->r1;
   uint32_t addr;
 
   CORE_DBG(core, "ldm\tr%d, {0x%02x}", r, list);
@@ -1469,45 +1984,50 @@ static void i_ldm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_b_c_imm(core_t *core)
+static void i_b_c_imm(core_t *core, decoded_t *d)
 {
-  int cond = GET_COND(core->opcode);
-  uint32_t imm = GET_IMM8(core->opcode) * 2;
+  int cond = d->r1;
+  uint32_t imm = d->imm;
   bool passed = false;
 
   switch (cond)
   {
-    case 0x00: passed = core->z; break;
-    case 0x01: passed = !core->z; break;
-    case 0x02: passed = core->c; break;
-    case 0x03: passed = !core->c; break;
-    case 0x04: passed = core->n; break;
-    case 0x05: passed = !core->n; break;
-    case 0x06: passed = core->v; break;
-    case 0x07: passed = !core->v; break;
-    case 0x08: passed = core->c && !core->z; break;
-    case 0x09: passed = !core->c || core->z; break;
-    case 0x0a: passed = core->n == core->v; break;
-    case 0x0b: passed = core->n != core->v; break;
-    case 0x0c: passed = !core->z && (core->n == core->v); break;
-    case 0x0d: passed = core->z || (core->n != core->v); break;
+    case 0x00: passed = flag_z(core); break;
+    case 0x01: passed = !flag_z(core); break;
+    case 0x02: passed = flag_c(core); break;
+    case 0x03: passed = !flag_c(core); break;
+    case 0x04: passed = flag_n(core); break;
+    case 0x05: passed = !flag_n(core); break;
+    case 0x06: passed = flag_v(core); break;
+    case 0x07: passed = !flag_v(core); break;
+    case 0x08: passed = flag_c(core) && !flag_z(core); break;
+    case 0x09: passed = !flag_c(core) || flag_z(core); break;
+    case 0x0a: passed = flag_n(core) == flag_v(core); break;
+    case 0x0b: passed = flag_n(core) != flag_v(core); break;
+    case 0x0c: passed = !flag_z(core) && (flag_n(core) == flag_v(core)); break;
+    case 0x0d: passed = flag_z(core) || (flag_n(core) != flag_v(core)); break;
     default:
       error("%s: invalid condition code at 0x%08x", core->name, core->r[PC]-2);
   }
 
-  imm |= (imm & 0x100) ? 0xfffffe00 : 0x00000000;
-
   const char *conds[] = {"eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le", "?", "?"};
-  CORE_DBG(core, "b%s\t0x%x [%s]", conds[cond], core->r[PC] + imm + 2, passed ? "taken" : "not taken");
+  CORE_DBG(core, "b%s\t0x%x [%s]", conds[cond], core->r[PC] + imm, passed ? "taken" : "not taken");
 
   if (passed)
-    core->r[PC] += imm + 2;
+  {
+    CORE_STATS(core, taken);
+    core->r[PC] += imm;
+  }
+  else
+  {
+    CORE_STATS(core, not_taken);
+  }
 }
 
 //-----------------------------------------------------------------------------
-static void i_udf_imm(core_t *core)
+static void i_udf_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM8(core->opcode);
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "udf\t0x%02x", imm);
   // TODO: interrupt
@@ -1516,9 +2036,9 @@ static void i_udf_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_svc_imm(core_t *core)
+static void i_svc_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM8(core->opcode);
+  uint32_t imm = d->imm;
 
   CORE_DBG(core, "svc\t0x%02x", imm);
   // TODO: interrupt
@@ -1527,277 +2047,1939 @@ static void i_svc_imm(core_t *core)
 }
 
 //-----------------------------------------------------------------------------
-static void i_b_imm(core_t *core)
+static void i_b_imm(core_t *core, decoded_t *d)
 {
-  uint32_t imm = GET_IMM11(core->opcode) * 2;
-
-  imm |= (imm & 0x800) ? 0xfffff000 : 0x00000000;
+  uint32_t imm = d->imm;
 
-  CORE_DBG(core, "b\t\t0x%x", core->r[PC] + imm + 2);
+  CORE_DBG(core, "b\t\t0x%x", core->r[PC] + imm);
 
-  core->r[PC] += imm + 2;
+  core->r[PC] += imm;
 }
 
 //-----------------------------------------------------------------------------
-static void i_32bit(core_t *core)
+static void i_undefined_32(core_t *core, decoded_t *d)
 {
-  uint32_t opcode;
-
-  opcode = ((uint32_t)core->opcode << 16) | core->flash[core->r[PC] >> 1];
   core->r[PC] += 2;
 
-  if (0xf000d000 == (opcode & 0xf800d000)) // BL  #imm
-  {
-    uint32_t imm10 = GET32_IMM10(opcode);
-    uint32_t imm11 = GET32_IMM11(opcode);
-    uint32_t j1 = GET32_J1(opcode);
-    uint32_t j2 = GET32_J2(opcode);
-    uint32_t s = GET32_S(opcode);
-    uint32_t i1, i2, target;
+  error("%s: undefined instruction 0x%08x at 0x%08x", core->name, d->imm,
+      core->r[PC]-4);
+}
+
+//-----------------------------------------------------------------------------
+static void i_bl(core_t *core, decoded_t *d)
+{
+  uint32_t target;
+
+  core->r[PC] += 2;
+  target = core->r[PC] + d->imm;
+
+  CORE_DBG(core, "bl\t0x%08x", target);
+
+  core->r[LR] = core->r[PC] | 1;
+  core->r[PC] = target;
+}
+
+//-----------------------------------------------------------------------------
+static void i_mrs(core_t *core, decoded_t *d)
+{
+  int rd = d->r1;
+  uint32_t imm = d->imm;
+  uint32_t immh = (imm >> 3) & 0x1f;
+  uint32_t imml = imm & 0x7;
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "mrs\tr%d, 0x%02x", rd, imm);
+
+  core->r[rd] = 0;
+
+  if (0 == immh)
+  {
+    if (imm & 1)
+      core->r[rd] |= core->ipsr;
+
+    if (0 == (imm & 4))
+      core->r[rd] |= (flag_n(core) << BIT_N) | (flag_z(core) << BIT_Z) | (flag_c(core) << BIT_C) | (flag_v(core) << BIT_V);
+  }
+  else if (1 == immh)
+  {
+    if (0 == imml || 1 == imml)
+      core->r[rd] = core->r[SP];
+  }
+  else if (2 == immh)
+  {
+    if (0 == imml)
+      core->r[rd] = core->pm;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void i_msr(core_t *core, decoded_t *d)
+{
+  int ra = d->r1;
+  uint32_t imm = d->imm;
+  uint32_t immh = (imm >> 3) & 0x1f;
+  uint32_t imml = imm & 0x7;
+  uint32_t rav = core->r[ra];
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "msr\t0x%02x, r%d", imm, ra);
+
+  if (0 == immh)
+  {
+    if (0 == (imm & 4))
+    {
+      set_flags(core, (rav & (1 << BIT_N)) > 0, (rav & (1 << BIT_Z)) > 0,
+          (rav & (1 << BIT_C)) > 0, (rav & (1 << BIT_V)) > 0);
+    }
+  }
+  else if (1 == immh)
+  {
+    if (0 == imml || 1 == imml)
+      core->r[SP] = rav & 0xfffffffc;
+  }
+  else if (2 == immh)
+  {
+    if (0 == imml)
+      core->pm = rav & 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void i_udf_w_imm(core_t *core, decoded_t *d)
+{
+  uint32_t imm = d->imm;
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "udf.w\t0x%04x", imm);
+  // TODO: interrupt
+
+  error("%s: udf.w not implemented at 0x%08x", core->name, core->r[PC]-2);
+}
+
+//-----------------------------------------------------------------------------
+static void i_dsb(core_t *core, decoded_t *d)
+{
+  uint32_t imm = d->imm;
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "dsb\t%d", imm);
+}
+
+//-----------------------------------------------------------------------------
+static void i_dmb(core_t *core, decoded_t *d)
+{
+  uint32_t imm = d->imm;
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "dmb\t%d", imm);
+}
+
+//-----------------------------------------------------------------------------
+static void i_isb(core_t *core, decoded_t *d)
+{
+  uint32_t imm = d->imm;
+
+  core->r[PC] += 2;
+
+  CORE_DBG(core, "isb\t%d", imm);
+}
+
+//-----------------------------------------------------------------------------
+static const instr_t instructions[] =
+{
+  { i_lsls_imm,		0xf800, 0x0000, FMT_R1_R2_IMM5, EXEC_ANY, STATS_NAME("lsls_imm") },
+  { i_lsrs_imm,		0xf800, 0x0800, FMT_R1_R2_IMM5, EXEC_ANY, STATS_NAME("lsrs_imm") },
+  { i_asrs_imm,		0xf800, 0x1000, FMT_R1_R2_IMM5, EXEC_ANY, STATS_NAME("asrs_imm") },
+  { i_adds_reg,		0xfe00, 0x1800, FMT_R1_R2_R3, EXEC_ANY, STATS_NAME("adds_reg") },
+  { i_subs_reg,		0xfe00, 0x1a00, FMT_R1_R2_R3, EXEC_ANY, STATS_NAME("subs_reg") },
+  { i_adds_imm3,	0xfe00, 0x1c00, FMT_R1_R2_IMM3, EXEC_ANY, STATS_NAME("adds_imm3") },
+  { i_subs_imm3,	0xfe00, 0x1e00, FMT_R1_R2_IMM3, EXEC_ANY, STATS_NAME("subs_imm3") },
+  { i_movs_imm,		0xf800, 0x2000, FMT_RD_IMM8, EXEC_ANY, STATS_NAME("movs_imm") },
+  { i_cmp_imm,		0xf800, 0x2800, FMT_RD_IMM8, EXEC_ANY, STATS_NAME("cmp_imm") },
+  { i_adds_imm8,	0xf800, 0x3000, FMT_RD_IMM8, EXEC_ANY, STATS_NAME("adds_imm8") },
+  { i_subs_imm8,	0xf800, 0x3800, FMT_RD_IMM8, EXEC_ANY, STATS_NAME("subs_imm8") },
+
+  { i_ands_reg,		0xffc0, 0x4000, FMT_R1_R2, EXEC_ANY, STATS_NAME("ands_reg") },
+  { i_eors_reg,		0xffc0, 0x4040, FMT_R1_R2, EXEC_ANY, STATS_NAME("eors_reg") },
+  { i_lsls_reg,		0xffc0, 0x4080, FMT_R1_R2, EXEC_ANY, STATS_NAME("lsls_reg") },
+  { i_lsrs_reg,		0xffc0, 0x40c0, FMT_R1_R2, EXEC_ANY, STATS_NAME("lsrs_reg") },
+  { i_asrs_reg,		0xffc0, 0x4100, FMT_R1_R2, EXEC_ANY, STATS_NAME("asrs_reg") },
+  { i_adcs_reg,		0xffc0, 0x4140, FMT_R1_R2, EXEC_ANY, STATS_NAME("adcs_reg") },
+  { i_sbcs_reg,		0xffc0, 0x4180, FMT_R1_R2, EXEC_ANY, STATS_NAME("sbcs_reg") },
+  { i_rors_reg,		0xffc0, 0x41c0, FMT_R1_R2, EXEC_ANY, STATS_NAME("rors_reg") },
+  { i_tst_reg,		0xffc0, 0x4200, FMT_R1_R2, EXEC_ANY, STATS_NAME("tst_reg") },
+  { i_rsbs_imm,		0xffc0, 0x4240, FMT_R1_R2, EXEC_ANY, STATS_NAME("rsbs_imm") },
+  { i_cmp_reg,		0xffc0, 0x4280, FMT_R1_R2, EXEC_ANY, STATS_NAME("cmp_reg") },
+  { i_cmn_reg,		0xffc0, 0x42c0, FMT_R1_R2, EXEC_ANY, STATS_NAME("cmn_reg") },
+  { i_orrs_reg,		0xffc0, 0x4300, FMT_R1_R2, EXEC_ANY, STATS_NAME("orrs_reg") },
+  { i_muls_reg,		0xffc0, 0x4340, FMT_R1_R2, EXEC_ANY, STATS_NAME("muls_reg") },
+  { i_bics_reg,		0xffc0, 0x4380, FMT_R1_R2, EXEC_ANY, STATS_NAME("bics_reg") },
+  { i_mvns_reg,		0xffc0, 0x43c0, FMT_R1_R2, EXEC_ANY, STATS_NAME("mvns_reg") },
+
+  { i_add_reg4,		0xff00, 0x4400, FMT_R1_4_R2_4, EXEC_ANY, STATS_NAME("add_reg4") },
+  { i_cmp_reg4,		0xff00, 0x4500, FMT_R1_4_R2_4, EXEC_ANY, STATS_NAME("cmp_reg4") },
+  { i_mov_reg4,		0xff00, 0x4600, FMT_R1_4_R2_4, EXEC_ANY, STATS_NAME("mov_reg4") },
+  { i_bx_reg4,		0xff87, 0x4700, FMT_R1_4_R2_4, EXEC_BX, STATS_NAME("bx_reg4") },
+  { i_blx_reg4,		0xff87, 0x4780, FMT_R1_4_R2_4, EXEC_BRANCH, STATS_NAME("blx_reg4") },
+
+  { i_ldr_pc,		0xf800, 0x4800, FMT_RD_IMM8_W, EXEC_MEM_PC, STATS_NAME("ldr_pc") },
+
+  { i_str_reg,		0xfe00, 0x5000, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("str_reg") },
+  { i_strh_reg,		0xfe00, 0x5200, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("strh_reg") },
+  { i_strb_reg,		0xfe00, 0x5400, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("strb_reg") },
+  { i_ldrsb_reg,	0xfe00, 0x5600, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("ldrsb_reg") },
+  { i_ldr_reg,		0xfe00, 0x5800, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("ldr_reg") },
+  { i_ldrh_reg,		0xfe00, 0x5a00, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("ldrh_reg") },
+  { i_ldrb_reg,		0xfe00, 0x5c00, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("ldrb_reg") },
+  { i_ldrsh_reg,	0xfe00, 0x5e00, FMT_R1_R2_R3, EXEC_MEM_REG, STATS_NAME("ldrsh_reg") },
+  { i_str_imm,		0xf800, 0x6000, FMT_R1_R2_IMM5_W, EXEC_MEM_IMM, STATS_NAME("str_imm") },
+  { i_ldr_imm,		0xf800, 0x6800, FMT_R1_R2_IMM5_W, EXEC_MEM_IMM, STATS_NAME("ldr_imm") },
+  { i_strb_imm,		0xf800, 0x7000, FMT_R1_R2_IMM5, EXEC_MEM_IMM, STATS_NAME("strb_imm") },
+  { i_ldrb_imm,		0xf800, 0x7800, FMT_R1_R2_IMM5, EXEC_MEM_IMM, STATS_NAME("ldrb_imm") },
+  { i_strh_imm,		0xf800, 0x8000, FMT_R1_R2_IMM5_H, EXEC_MEM_IMM, STATS_NAME("strh_imm") },
+  { i_ldrh_imm,		0xf800, 0x8800, FMT_R1_R2_IMM5_H, EXEC_MEM_IMM, STATS_NAME("ldrh_imm") },
+  { i_str_r_sp_imm,	0xf800, 0x9000, FMT_RD_IMM8_W, EXEC_MEM_SP, STATS_NAME("str_r_sp_imm") },
+  { i_ldr_r_sp_imm,	0xf800, 0x9800, FMT_RD_IMM8_W, EXEC_MEM_SP, STATS_NAME("ldr_r_sp_imm") },
+
+  { i_add_r_pc_imm,	0xf800, 0xa000, FMT_RD_IMM8_W, EXEC_ANY, STATS_NAME("add_r_pc_imm") },
+  { i_add_r_sp_imm,	0xf800, 0xa800, FMT_RD_IMM8_W, EXEC_ANY, STATS_NAME("add_r_sp_imm") },
+
+  { i_add_sp_imm,	0xff80, 0xb000, FMT_IMM7_W, EXEC_ANY, STATS_NAME("add_sp_imm") },
+  { i_sub_sp_imm,	0xff80, 0xb080, FMT_IMM7_W, EXEC_ANY, STATS_NAME("sub_sp_imm") },
+  { i_sxth_reg,		0xffc0, 0xb200, FMT_R1_R2, EXEC_ANY, STATS_NAME("sxth_reg") },
+  { i_sxtb_reg,		0xffc0, 0xb240, FMT_R1_R2, EXEC_ANY, STATS_NAME("sxtb_reg") },
+  { i_uxth_reg,		0xffc0, 0xb280, FMT_R1_R2, EXEC_ANY, STATS_NAME("uxth_reg") },
+  { i_uxtb_reg,		0xffc0, 0xb2c0, FMT_R1_R2, EXEC_ANY, STATS_NAME("uxtb_reg") },
+  { i_push,		0xfe00, 0xb400, FMT_LIST, EXEC_PUSH, STATS_NAME("push") },
+  { i_pop,		0xfe00, 0xbc00, FMT_LIST, EXEC_POP, STATS_NAME("pop") },
+  { i_cpsie,		0xffff, 0xb662, FMT_NONE, EXEC_FIRST, STATS_NAME("cpsie") },
+  { i_cpsid,		0xffff, 0xb672, FMT_NONE, EXEC_FIRST, STATS_NAME("cpsid") },
+  { i_rev_reg,		0xffc0, 0xba00, FMT_R1_R2, EXEC_ANY, STATS_NAME("rev_reg") },
+  { i_rev16_reg,	0xffc0, 0xba40, FMT_R1_R2, EXEC_ANY, STATS_NAME("rev16_reg") },
+  { i_revsh_reg,	0xffc0, 0xbac0, FMT_R1_R2, EXEC_ANY, STATS_NAME("revsh_reg") },
+  { i_bkpt_imm,		0xff00, 0xbe00, FMT_RD_IMM8, EXEC_ANY, STATS_NAME("bkpt_imm") },
+  { i_nop,		0xffff, 0xbf00, FMT_NONE, EXEC_ANY, STATS_NAME("nop") },
+  { i_yield,		0xffff, 0xbf10, FMT_NONE, EXEC_ANY, STATS_NAME("yield") },
+  { i_wfe,		0xffff, 0xbf20, FMT_NONE, EXEC_ALONE, STATS_NAME("wfe") },
+  { i_wfi,		0xffff, 0xbf30, FMT_NONE, EXEC_ALONE, STATS_NAME("wfi") },
+  { i_sev,		0xffff, 0xbf40, FMT_NONE, EXEC_ANY, STATS_NAME("sev") },
+
+  { i_stm,		0xf800, 0xc000, FMT_RD_IMM8, EXEC_MEM_LIST, STATS_NAME("stm") },
+  { i_ldm,		0xf800, 0xc800, FMT_RD_IMM8, EXEC_MEM_LIST, STATS_NAME("ldm") },
+
+  { i_b_c_imm,		0xf000, 0xd000, FMT_COND_IMM8, EXEC_BRANCH, STATS_NAME("b_c_imm") },
+  { i_udf_imm,		0xff00, 0xde00, FMT_RD_IMM8, EXEC_FIRST, STATS_NAME("udf_imm") },
+  { i_svc_imm,		0xff00, 0xdf00, FMT_RD_IMM8, EXEC_FIRST, STATS_NAME("svc_imm") },
+
+  { i_b_imm,		0xf800, 0xe000, FMT_IMM11, EXEC_BRANCH, STATS_NAME("b_imm") },
+
+  { i_undefined_32,	0xf800, 0xf000, FMT_32BIT, EXEC_FIRST, STATS_NAME("undefined_32") },
+};
+
+//-----------------------------------------------------------------------------
+static const instr32_t instructions_32bit[] =
+{
+  { i_bl,		0xf800d000, 0xf000d000, FMT32_BL, EXEC_BRANCH, STATS_NAME("bl") },
+  { i_mrs,		0xfffff000, 0xf3ef8000, FMT32_RD_IMM8, EXEC_ANY, STATS_NAME("mrs") },
+  { i_msr,		0xfff0ff00, 0xf3808800, FMT32_RA_IMM8, EXEC_FIRST, STATS_NAME("msr") },
+  { i_udf_w_imm,	0xfff0f000, 0xf7f0a000, FMT32_IMM16, EXEC_FIRST, STATS_NAME("udf_w_imm") },
+  { i_dsb,		0xfffffff0, 0xf3bf8f40, FMT32_IMM4, EXEC_ANY, STATS_NAME("dsb") },
+  { i_dmb,		0xfffffff0, 0xf3bf8f50, FMT32_IMM4, EXEC_ANY, STATS_NAME("dmb") },
+  { i_isb,		0xfffffff0, 0xf3bf8f60, FMT32_IMM4, EXEC_ANY, STATS_NAME("isb") },
+};
+
+static const instr_t undefined = { i_undefined, 0x0000, 0x0000, FMT_NONE, EXEC_FIRST, STATS_NAME("undefined") };
+
+#ifdef USE_LIBCORE
+#include "core_gen.c"
+#endif
+
+//-----------------------------------------------------------------------------
+static bool is_more_specific(const instr_t *i1, const instr_t *i2)
+{
+  return ((i1->value & i2->mask) == i2->value);
+}
+
+//-----------------------------------------------------------------------------
+static uint16_t distribute_bits(uint16_t d, uint16_t n)
+{
+  uint16_t res = 0;
+  int in, id;
+
+  for (id = 0, in = 0; id < 16; id++)
+  {
+    if (0 == (d & (1 << id)))
+    {
+      if (n & (1 << in))
+        res |= 1 << id;
+      in++;
+    }
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static int count_zeros(uint16_t d)
+{
+  int i, cnt = 0;
+
+  for (i = 0; i < 16; i++)
+  {
+    if (0 == (d & (1 << i)))
+      cnt++;
+  }
+
+  return cnt;
+} 
+
+//-----------------------------------------------------------------------------
+static void core_decode_32bit(decoded_t *d, uint32_t opcode)
+{
+  const instr32_t *instr = NULL;
+  uint32_t imm10, imm11, j1, j2, s, i1, i2;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(instructions_32bit); i++)
+  {
+    if (instructions_32bit[i].value == (opcode & instructions_32bit[i].mask))
+    {
+      instr = &instructions_32bit[i];
+      break;
+    }
+  }
+
+  if (NULL == instr)
+  {
+    d->imm = opcode;
+    return;
+  }
+
+  d->handler = instr->handler;
+  d->exec = instr->exec;
+#ifdef USE_STATS
+  d->index = ARRAY_SIZE(instructions) + (instr - instructions_32bit);
+#endif
+
+  switch (instr->format)
+  {
+    case FMT32_BL:
+      imm10 = GET32_IMM10(opcode);
+      imm11 = GET32_IMM11(opcode);
+      j1 = GET32_J1(opcode);
+      j2 = GET32_J2(opcode);
+      s = GET32_S(opcode);
+      i1 = ~(j1 ^ s) & 1;
+      i2 = ~(j2 ^ s) & 1;
+
+      d->imm = (s << 24) | (i1 << 23) | (i2 << 22) | (imm10 << 12) | (imm11 << 1);
+      d->imm |= s ? 0xff000000 : 0x00000000;
+      break;
+
+    case FMT32_RD_IMM8:
+      d->r1 = GET32_RD(opcode);
+      d->imm = GET32_IMM8(opcode);
+      break;
+
+    case FMT32_RA_IMM8:
+      d->r1 = GET32_RA(opcode);
+      d->imm = GET32_IMM8(opcode);
+      break;
+
+    case FMT32_IMM16:
+      d->imm = GET32_IMM16(opcode);
+      break;
+
+    case FMT32_IMM4:
+      d->imm = GET32_IMM4(opcode);
+      break;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void i_hook(core_t *core, decoded_t *d)
+{
+  hook_t *hook = &((image_t *)core->image)->hooks[d->imm];
+  int cycles = -1;
+
+  // Tail calls from exception handlers return through the firmware code
+  if (0xf0000000 != (core->r[LR] & 0xf0000000))
+    cycles = hook->hook(core);
+
+  if (cycles < 0)
+  {
+    hook->decoded.handler(core, &hook->decoded);
+    return;
+  }
+
+  CORE_DBG(core, "native routine at 0x%08x", hook->addr);
+
+  core->r[PC] = core->r[LR] & 0xfffffffe;
+  core_wait(core, cycles - 1);
+}
+
+//-----------------------------------------------------------------------------
+static void core_decode(core_t *core, uint32_t addr, decoded_t *d)
+{
+  image_t *image = (image_t *)core->image;
+  uint16_t opcode = core->flash[addr >> 1];
+  const instr_t *instr = hash[opcode];
+  uint32_t imm;
+
+  d->handler = instr->handler;
+  d->imm = 0;
+  d->r1 = 0;
+  d->r2 = 0;
+  d->r3 = 0;
+  d->exec = instr->exec;
+#ifdef USE_STATS
+  d->index = (&undefined == instr) ? STATS_UNDEFINED : (instr - instructions);
+  d->opcode = opcode;
+#endif
+
+  switch (instr->format)
+  {
+    case FMT_NONE:
+      break;
+
+    case FMT_R1_R2:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      break;
+
+    case FMT_R1_R2_R3:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      d->r3 = GET_R3(opcode);
+      break;
+
+    case FMT_R1_R2_IMM3:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      d->imm = GET_IMM3(opcode);
+      break;
+
+    case FMT_R1_R2_IMM5:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      d->imm = GET_IMM5(opcode);
+      break;
+
+    case FMT_R1_R2_IMM5_H:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      d->imm = GET_IMM5(opcode) * 2;
+      break;
+
+    case FMT_R1_R2_IMM5_W:
+      d->r1 = GET_R1(opcode);
+      d->r2 = GET_R2(opcode);
+      d->imm = GET_IMM5(opcode) * 4;
+      break;
+
+    case FMT_R1_4_R2_4:
+      d->r1 = GET_R1_4(opcode);
+      d->r2 = GET_R2_4(opcode);
+      break;
+
+    case FMT_RD_IMM8:
+      d->r1 = GET_R_IMM8(opcode);
+      d->imm = GET_IMM8(opcode);
+      break;
+
+    case FMT_RD_IMM8_W:
+      d->r1 = GET_R_IMM8(opcode);
+      d->imm = GET_IMM8(opcode) * 4;
+      break;
+
+    case FMT_IMM7_W:
+      d->imm = GET_IMM7(opcode) * 4;
+      break;
+
+    case FMT_LIST:
+      d->r1 = GET_EXTRA_REG(opcode);
+      d->imm = GET_IMM8(opcode);
+      break;
+
+    case FMT_COND_IMM8:
+      imm = GET_IMM8(opcode) * 2;
+      imm |= (imm & 0x100) ? 0xfffffe00 : 0x00000000;
+      d->r1 = GET_COND(opcode);
+      d->imm = imm + 2;
+      break;
+
+    case FMT_IMM11:
+      imm = GET_IMM11(opcode) * 2;
+      imm |= (imm & 0x800) ? 0xfffff000 : 0x00000000;
+      d->imm = imm + 2;
+      break;
+
+    case FMT_32BIT:
+      core_decode_32bit(d, ((uint32_t)opcode << 16) | core->flash[(addr >> 1) + 1]);
+      break;
+  }
+
+  if (EXEC_ANY == d->exec && FMT_R1_4_R2_4 == instr->format && PC == d->r1)
+    d->exec = EXEC_BRANCH;
+  else if (EXEC_MEM_LIST == d->exec)
+    d->r3 = __builtin_popcount(d->imm);
+  else if (EXEC_PUSH == d->exec || EXEC_POP == d->exec)
+    d->r3 = __builtin_popcount(d->imm) + d->r1;
+
+#ifdef USE_LIBCORE
+  if (specialized[opcode])
+    d->handler = specialized[opcode];
+#endif
+
+  for (int i = 0; i < image->hooks_count; i++)
+  {
+    if (image->hooks[i].addr == addr)
+    {
+      image->hooks[i].decoded = *d;
+      d->handler = i_hook;
+      d->imm = i;
+      d->exec = EXEC_ALONE;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void i_decode(core_t *core, decoded_t *d)
+{
+  decoded_t *decoded = (decoded_t *)core->decoded;
+
+  core_decode(core, (d - decoded) * 2, d);
+  d->handler(core, d);
+}
+
+#ifdef USE_STATS
+//-----------------------------------------------------------------------------
+static inline void core_stats_exec(core_t *core, decoded_t *d, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    core->ext->stats.instr[d[i].index]++;
+    stats_opcodes[d[i].opcode]++;
+  }
+}
+#endif
+
+#ifdef USE_AOT
+//-----------------------------------------------------------------------------
+static uint32_t core_aot_hash(uint16_t *flash, uint32_t size)
+{
+  uint8_t *data = (uint8_t *)flash;
+  uint32_t hash = 0x811c9dc5;
+
+  // Trailing zeros are not hashed, translations don't depend on the flash size
+  while (size && 0 == data[size - 1])
+    size--;
+
+  for (uint32_t i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 0x01000193;
+
+  return hash;
+}
+
+//-----------------------------------------------------------------------------
+static void core_aot_load(core_t *core, image_t *image)
+{
+  char *path = ((soc_t *)core->soc)->path;
+  const uint32_t *hash;
+  const int *size, *count;
+  char name[1024];
+  void *lib;
+
+  // Translated image is stored next to the firmware with ".so" appended
+  snprintf(name, sizeof(name), "%s%s.so", strchr(path, '/') ? "" : "./", path);
+
+  lib = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+
+  if (NULL == lib)
+    return;
+
+  hash = dlsym(lib, "aot_hash");
+  size = dlsym(lib, "aot_core_size");
+  count = dlsym(lib, "aot_count");
+  image->aot = dlsym(lib, "aot_blocks");
+
+  // Stale translations are ignored, the image is interpreted instead
+  if (NULL == hash || NULL == size || NULL == count || NULL == image->aot ||
+      *hash != core_aot_hash(image->flash, image->size) || *size != (int)sizeof(core_t))
+  {
+    image->aot = NULL;
+    dlclose(lib);
+    return;
+  }
+
+  image->aot_count = *count;
+}
+
+//-----------------------------------------------------------------------------
+static void *core_aot_find(core_t *core, uint32_t addr, int count)
+{
+  image_t *image = (image_t *)core->image;
+  int first = 0;
+  int last = image->aot_count - 1;
+
+  while (first <= last)
+  {
+    int i = (first + last) / 2;
+
+    if (image->aot[i].addr == addr)
+      return (image->aot[i].count == count) ? image->aot[i].run : NULL;
+    else if (image->aot[i].addr < addr)
+      first = i + 1;
+    else
+      last = i - 1;
+  }
+
+  return NULL;
+}
+#endif
+
+#ifdef DETECT_FLASH_WRITES
+//-----------------------------------------------------------------------------
+static bool core_image_match(image_t *image, core_t *core)
+{
+  return image->size == core->flash_size &&
+      0 == memcmp(image->flash, core->flash, core->flash_size);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static image_t *core_image(core_t *core)
+{
+  image_t *image;
+  image_t *other = NULL;
+
+#ifdef DETECT_FLASH_WRITES
+  for (image = images; image; image = image->next)
+  {
+    if (!core_image_match(image, core))
+      continue;
+
+    if (image->thread == g_part->thread)
+      return image;
+
+    other = image;
+  }
+#endif
+
+  image = sim_malloc(sizeof(image_t));
+  image->size = core->flash_size;
+  image->flash = sim_malloc(image->size);
+  image->decoded = sim_malloc(image->size / 2 * sizeof(decoded_t));
+  image->blocks = sim_malloc(image->size / 2 * sizeof(block_t *));
+  image->backoff = sim_malloc(image->size / 2);
+  image->poll = sim_malloc(image->size / 2);
+  image->thread = g_part->thread;
+  memcpy(image->flash, core->flash, image->size);
+
+  for (uint32_t i = 0; i < image->size / 2; i++)
+    image->decoded[i].handler = i_decode;
+
+  // The same firmware running on another thread gets the same hooks
+  if (other && other->hooks_count)
+  {
+    image->hooks = sim_malloc(other->hooks_count * sizeof(hook_t));
+    memcpy(image->hooks, other->hooks, other->hooks_count * sizeof(hook_t));
+    image->hooks_count = other->hooks_count;
+
+    for (int i = 0; i < image->hooks_count; i++)
+      image->decoded[image->hooks[i].addr >> 1].handler = i_decode;
+  }
+
+  image->next = images;
+  images = image;
+
+#ifdef USE_AOT
+  core_aot_load(core, image);
+#endif
+
+  return image;
+}
+
+//-----------------------------------------------------------------------------
+static block_t *core_block_build(core_t *core, uint32_t addr)
+{
+  decoded_t code[CORE_RUN_LIMIT];
+  handler_t *handlers[CORE_RUN_LIMIT];
+  block_t *block;
+  uint32_t pc = addr;
+  int count = 0;
+  bool ends = false;
+
+  while (count < CORE_RUN_LIMIT && pc < core->flash_size)
+  {
+    const instr_t *instr = hash[core->flash[pc >> 1]];
+    decoded_t *d = &code[count];
+
+    core_decode(core, pc, d);
+
+    if (count > 0 && (EXEC_FIRST == d->exec || EXEC_ALONE == d->exec))
+      break;
+
+    // Generic handlers, decoded ones may be specialized
+    handlers[count] = (FMT_32BIT == instr->format || i_hook == d->handler) ?
+        d->handler : instr->handler;
+
+    pc += (FMT_32BIT == instr->format) ? 4 : 2;
+    count++;
+
+    if (EXEC_BRANCH == d->exec || EXEC_BX == d->exec || EXEC_ALONE == d->exec ||
+        (EXEC_POP == d->exec && d->r1))
+    {
+      ends = (EXEC_ALONE == d->exec);
+      break;
+    }
+  }
+
+  block = sim_malloc(sizeof(block_t) + count * sizeof(decoded_t));
+  block->addr = addr;
+  block->size = pc - addr;
+  block->count = count;
+  block->ends = ends;
+  memcpy(block->code, code, count * sizeof(decoded_t));
+
+  core_block_fuse(block, handlers);
+  block->delay = core_delay_build(block, handlers);
+  block->halt = (1 == count && i_b_imm == handlers[0] && 0 == block->size + code[0].imm);
+
+#ifdef USE_AOT
+  block->native = core_aot_find(core, addr, count);
+#endif
+
+  return block;
+}
+
+//-----------------------------------------------------------------------------
+static inline block_t *core_block_lookup(core_t *core)
+{
+  block_t **blocks = ((image_t *)core->image)->blocks;
+  uint32_t addr = core->r[PC] & ~1;
+
+  if (NULL == blocks[addr >> 1] || blocks[addr >> 1]->addr != addr)
+    blocks[addr >> 1] = core_block_build(core, addr);
+
+  return blocks[addr >> 1];
+}
+
+//-----------------------------------------------------------------------------
+static inline block_t *core_block_chain(core_t *core, block_t *block)
+{
+  uint32_t addr = core->r[PC] & ~1;
+  block_t *next;
+
+  if (block->next[0] && block->next[0]->addr == addr)
+    return block->next[0];
+
+  if (block->next[1] && block->next[1]->addr == addr)
+    return block->next[1];
+
+  next = core_block_lookup(core);
+  block->next[1] = block->next[0];
+  block->next[0] = next;
+
+  return next;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool core_in_ram(core_t *core, uint32_t first, uint32_t last)
+{
+  return first < core->mem_size && last < core->mem_size && first <= last;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool core_can_continue(core_t *core, decoded_t *d)
+{
+  uint32_t addr;
+
+  switch (d->exec)
+  {
+    case EXEC_ANY:
+    case EXEC_BRANCH:
+      return true;
+
+    case EXEC_BX:
+      return !(core->ipsr && 0xf0000000 == (core->r[d->r2] & 0xf0000000));
+
+    case EXEC_MEM_REG:
+      return (core->r[d->r2] + core->r[d->r3]) < core->mem_size;
+
+    case EXEC_MEM_IMM:
+      return (core->r[d->r2] + d->imm) < core->mem_size;
+
+    case EXEC_MEM_SP:
+      return (core->r[SP] + d->imm) < core->mem_size;
+
+    case EXEC_MEM_PC:
+      return (core->r[PC] + d->imm + 4) < core->mem_size;
+
+    case EXEC_MEM_LIST:
+      addr = core->r[d->r1];
+      return core_in_ram(core, addr, addr + d->r3 * 4 - 4);
+
+    case EXEC_PUSH:
+      addr = core->r[SP] - d->r3 * 4;
+      return core_in_ram(core, addr, addr + d->r3 * 4 - 4);
+
+    case EXEC_POP:
+      addr = core->r[SP];
+      if (!core_in_ram(core, addr, addr + d->r3 * 4 - 4))
+        return false;
+      if (d->r1 && core->ipsr)
+        return 0xf0000000 != (((uint32_t *)core->ram)[(addr + d->r3 * 4 - 4) >> 2] & 0xf0000000);
+      return true;
+  }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+static int f_cmp_imm_b_c_imm(core_t *core, decoded_t *d)
+{
+  i_cmp_imm(core, &d[0]);
+  core->r[PC] += 2;
+  i_b_c_imm(core, &d[1]);
+  return 2;
+}
+
+//-----------------------------------------------------------------------------
+static int f_cmp_reg_b_c_imm(core_t *core, decoded_t *d)
+{
+  i_cmp_reg(core, &d[0]);
+  core->r[PC] += 2;
+  i_b_c_imm(core, &d[1]);
+  return 2;
+}
+
+//-----------------------------------------------------------------------------
+static int f_ldr_pc_ldr_imm(core_t *core, decoded_t *d)
+{
+  i_ldr_pc(core, &d[0]);
+
+  if (!core_can_continue(core, &d[1]))
+    return 1;
+
+  core->r[PC] += 2;
+  i_ldr_imm(core, &d[1]);
+  return 2;
+}
+
+#ifdef DETECT_FLASH_WRITES
+//-----------------------------------------------------------------------------
+static int f_push_bl(core_t *core, decoded_t *d)
+{
+  i_push(core, &d[0]);
+  core->r[PC] += 2;
+  i_bl(core, &d[1]);
+  return 2;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static int f_movs_imm_str_imm(core_t *core, decoded_t *d)
+{
+  i_movs_imm(core, &d[0]);
+
+  // Peripheral stores stay at the start of the next run, so they happen
+  // on their own cycle
+  if (!core_can_continue(core, &d[1]))
+    return 1;
+
+  core->r[PC] += 2;
+  i_str_imm(core, &d[1]);
+  return 2;
+}
+
+//-----------------------------------------------------------------------------
+static int f_ldr_pc_movs_imm_str_imm(core_t *core, decoded_t *d)
+{
+  i_ldr_pc(core, &d[0]);
+  core->r[PC] += 2;
+  i_movs_imm(core, &d[1]);
+
+  if (!core_can_continue(core, &d[2]))
+    return 2;
+
+  core->r[PC] += 2;
+  i_str_imm(core, &d[2]);
+  return 3;
+}
+
+//-----------------------------------------------------------------------------
+static void core_block_fuse(block_t *block, handler_t **handlers)
+{
+  static const struct
+  {
+    int        size;
+    handler_t  *handlers[FUSE_MAX];
+    fused_t    *fused;
+  } sequences[] =
+  {
+    // Longer sequences are matched first
+    { 3, { i_ldr_pc,   i_movs_imm, i_str_imm }, f_ldr_pc_movs_imm_str_imm },
+    { 2, { i_cmp_imm,  i_b_c_imm },             f_cmp_imm_b_c_imm },
+    { 2, { i_cmp_reg,  i_b_c_imm },             f_cmp_reg_b_c_imm },
+    { 2, { i_ldr_pc,   i_ldr_imm },             f_ldr_pc_ldr_imm },
+#ifdef DETECT_FLASH_WRITES
+    // A push into the flash could modify the call
+    { 2, { i_push,     i_bl },                  f_push_bl },
+#endif
+    { 2, { i_movs_imm, i_str_imm },             f_movs_imm_str_imm },
+  };
+
+  // The first instruction of a run is always executed on its own
+  for (int i = 1; i < block->count - 1; i++)
+  {
+    for (int j = 0; j < (int)ARRAY_SIZE(sequences); j++)
+    {
+      int size = sequences[j].size;
+
+      if (i + size > block->count ||
+          0 != memcmp(&handlers[i], sequences[j].handlers, size * sizeof(handler_t *)))
+        continue;
+
+      if (NULL == block->fused)
+        block->fused = sim_malloc(block->count * sizeof(fused_t *));
+
+      block->fused[i] = sequences[j].fused;
+      i += size - 1;
+      break;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static delay_t *core_delay_build(block_t *block, handler_t **handlers)
+{
+  decoded_t *last = &block->code[block->count - 1];
+  delay_t delay = { .reg = -1, .cmp = -1, .fixed = -1 };
+  delay_t *res;
+
+  if (i_b_c_imm != handlers[block->count - 1] || 0 != block->size + last->imm)
+    return NULL;
+
+  delay.cond = last->r1;
+
+  // N and V on their own depend on more than the order of the operands
+  if (0x00 == delay.cond || (delay.cond >= 0x04 && delay.cond <= 0x07) || delay.cond > 0x0d)
+    return NULL;
+
+  for (int i = 0; i < block->count - 1; i++)
+  {
+    handler_t *h = handlers[i];
+    decoded_t *d = &block->code[i];
+    uint32_t step = 0;
+    int reg;
+
+    if (i_nop == h || i_yield == h)
+      continue;
+
+    delay.imm = d->imm;
+    delay.fixed = -1;
+    delay.swap = false;
+    delay.add = false;
+
+    if (i_adds_imm8 == h || i_subs_imm8 == h)
+    {
+      reg = d->r1;
+      step = (i_adds_imm8 == h) ? (uint32_t)d->imm : -(uint32_t)d->imm;
+      delay.add = (i_adds_imm8 == h);
+    }
+    else if ((i_adds_imm3 == h || i_subs_imm3 == h) && d->r1 == d->r2)
+    {
+      reg = d->r1;
+      step = (i_adds_imm3 == h) ? (uint32_t)d->imm : -(uint32_t)d->imm;
+      delay.add = (i_adds_imm3 == h);
+    }
+    else if (i_cmp_imm == h)
+    {
+      reg = d->r1;
+    }
+    else if ((i_cmp_reg == h || i_cmp_reg4 == h) && d->r1 != d->r2 &&
+        (delay.reg == d->r1 || delay.reg == d->r2))
+    {
+      reg = delay.reg;
+      delay.swap = (reg == d->r2);
+      delay.fixed = delay.swap ? d->r1 : d->r2;
+
+      if (PC == delay.fixed)
+        return NULL;
+    }
+    else
+    {
+      return NULL;
+    }
+
+    if (delay.reg >= 0 && reg != delay.reg)
+      return NULL;
+
+    delay.reg = reg;
+    delay.cmp = i;
+    delay.pre = delay.step;
+    delay.step += step;
+  }
+
+  // Only equality is preserved when the comparison is replaced by an addition
+  if (delay.cmp < 0 || 0 == delay.step || (delay.add && 0x01 != delay.cond))
+    return NULL;
+
+  res = sim_malloc(sizeof(delay_t));
+  *res = delay;
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static uint32_t core_delay_count(delay_t *delay, uint32_t x, uint32_t y)
+{
+  int64_t x0, y0, step, hi, count;
+  bool sign, less, equal;
+
+  // The number of iterations for which the loop condition holds, zero if the
+  // loop ends only after the register wraps around
+  if (0x01 == delay->cond)
+  {
+    uint32_t diff = y - x;
+    int shift = __builtin_ctz(delay->step);
+    uint32_t odd = delay->step >> shift;
+    uint32_t inv = odd;
+
+    if (diff & ((1u << shift) - 1))
+      return 0;
+
+    for (int i = 0; i < 5; i++)
+      inv *= 2 - odd * inv;
+
+    return ((diff >> shift) * inv) & (0xffffffff >> shift);
+  }
+
+  sign = (delay->cond >= 0x0a);
+  less = (0x03 == delay->cond || 0x09 == delay->cond || 0x0b == delay->cond || 0x0d == delay->cond);
+  equal = (0x02 == delay->cond || 0x09 == delay->cond || 0x0a == delay->cond || 0x0d == delay->cond);
+
+  if (delay->swap)
+    less = !less;
+
+  x0 = sign ? (int64_t)(int32_t)x : (int64_t)x;
+  y0 = sign ? (int64_t)(int32_t)y : (int64_t)y;
+  step = (int32_t)delay->step;
+  hi = sign ? INT32_MAX : UINT32_MAX;
+
+  // Reduce to x < y with x increasing
+  if (!less)
+  {
+    x0 = -x0;
+    y0 = -y0;
+    step = -step;
+    hi = sign ? -(int64_t)INT32_MIN : 0;
+  }
+
+  if (equal)
+    y0++;
+
+  if (x0 >= y0 || step <= 0)
+    return 0;
+
+  count = (y0 - x0 + step - 1) / step;
+
+  if (x0 + count * step > hi || count > UINT32_MAX)
+    return 0;
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+static int core_delay_run(core_t *core, block_t *block)
+{
+  delay_t *delay = block->delay;
+  decoded_t *d = &block->code[delay->cmp];
+  uint32_t r = core->r[delay->reg];
+  uint32_t y = (delay->fixed < 0) ? delay->imm : core->r[delay->fixed];
+  uint32_t count;
+
+  if (delay->add)
+    y = -y;
+
+  // Skip all iterations but the last one. The last one is executed normally,
+  // as well as the compare of the last skipped iteration to set the flags.
+  count = core_delay_count(delay, r + delay->pre, y);
+  count = min(count, (uint32_t)(DELAY_LIMIT / block->count));
+
+  if (count < DELAY_MIN)
+    return 0;
+
+  core->r[delay->reg] = r + (count - 1) * delay->step + delay->pre;
+  d->handler(core, d);
+  core->r[delay->reg] = r + count * delay->step;
+
+  return count * block->count;
+}
+
+#ifdef USE_JIT
+//-----------------------------------------------------------------------------
+static bool core_jit_step(core_t *core, decoded_t *d)
+{
+  if (!core_can_continue(core, d))
+    return false;
+
+  core->r[PC] += 2;
+  d->handler(core, d);
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_exit(jit_t *jit, int cc, int pending, int executed)
+{
+  int label = jit_jcc(jit, cc ^ 1);
+
+  if (pending)
+    jit_add_imm(jit, JIT_R(PC), pending);
+
+  jit_leave(jit, executed);
+  jit_patch(jit, label);
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_cv(core_t *core)
+{
+  set_c(core, flag_c(core));
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_explicit(jit_t *jit)
+{
+  int label;
+
+  jit_cmp8_imm(jit, JIT_F(flags.lazy), 0);
+  label = jit_jcc(jit, JIT_E);
+  jit_call(jit, core_jit_cv, NULL);
+  jit_patch(jit, label);
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_flags(jit_t *jit, int carry)
+{
+  if (carry >= 0)
+  {
+    jit_setcc(jit, carry, JIT_F(flags.c));
+    jit_setcc(jit, JIT_O, JIT_F(flags.v));
+    jit_store_imm8(jit, JIT_F(flags.lazy), 0);
+  }
+
+  jit_movsxd(jit, JIT_EDX, JIT_EAX);
+  jit_store64(jit, JIT_F(flags.nz), JIT_EDX);
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_load(jit_t *jit, decoded_t *d, int type, int align,
+    int pending, int executed)
+{
+  core_jit_exit(jit, JIT_AE, pending, executed);
+  jit_alu_imm(jit, JIT_AND, JIT_ECX, ~(align - 1));
+  jit_load64(jit, JIT_R9, JIT_F(ram));
+  jit_load_mem(jit, type, JIT_EAX, JIT_R9, JIT_ECX, 1, 0);
+  jit_store(jit, JIT_R(d->r1), JIT_EAX);
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_store(jit_t *jit, decoded_t *d, int bits, int pending,
+    int executed)
+{
+  core_jit_exit(jit, JIT_AE, pending, executed);
+  jit_alu(jit, JIT_CMP, JIT_ECX, JIT_F(flash_size));
+  core_jit_exit(jit, JIT_B, pending, executed);
+  jit_alu_imm(jit, JIT_AND, JIT_ECX, ~(bits / 8 - 1));
+
+  jit_load(jit, JIT_R8D, JIT_F(undo_count));
+  jit_load64(jit, JIT_R9, JIT_F(ram));
+  jit_load64(jit, JIT_R10, JIT_F(ext));
+  jit_mov(jit, JIT_EDX, JIT_ECX);
+  jit_alu_imm(jit, JIT_AND, JIT_EDX, ~3);
+  jit_store_mem(jit, 32, JIT_R10, JIT_R8D, 4, JIT_X(undo_addr), JIT_EDX);
+  jit_load_mem(jit, JIT_WORD, JIT_EDX, JIT_R9, JIT_EDX, 1, 0);
+  jit_store_mem(jit, 32, JIT_R10, JIT_R8D, 4, JIT_X(undo_data), JIT_EDX);
+  jit_inc(jit, JIT_F(undo_count));
+
+  jit_load(jit, JIT_EAX, JIT_R(d->r1));
+  jit_store_mem(jit, bits, JIT_R9, JIT_ECX, 1, 0, JIT_EAX);
+}
+
+//-----------------------------------------------------------------------------
+static bool core_jit_native(core_t *core, jit_t *jit, decoded_t *d,
+    handler_t *h, uint32_t pc, int *pending, int executed)
+{
+  int r1 = JIT_R(d->r1);
+  int r2 = JIT_R(d->r2);
+  int r3 = JIT_R(d->r3);
+
+  if (i_lsls_imm == h || ((i_lsrs_imm == h || i_asrs_imm == h) && d->imm))
+  {
+    // V must be kept when C is replaced
+    if (d->imm)
+      core_jit_explicit(jit);
+
+    jit_load(jit, JIT_EAX, r2);
+
+    if (d->imm)
+    {
+      jit_shift(jit, (i_lsls_imm == h) ? JIT_SHL : (i_lsrs_imm == h) ? JIT_SHR : JIT_SAR,
+          JIT_EAX, d->imm);
+      jit_setcc(jit, JIT_B, JIT_F(flags.c));
+    }
+
+    core_jit_flags(jit, -1);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_adds_reg == h || i_subs_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r2);
+    jit_alu(jit, (i_adds_reg == h) ? JIT_ADD : JIT_SUB, JIT_EAX, r3);
+    core_jit_flags(jit, (i_adds_reg == h) ? JIT_B : JIT_AE);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_adds_imm3 == h || i_subs_imm3 == h || i_adds_imm8 == h ||
+      i_subs_imm8 == h || i_cmp_imm == h)
+  {
+    bool add = (i_adds_imm3 == h || i_adds_imm8 == h);
+
+    jit_load(jit, JIT_EAX, (i_adds_imm3 == h || i_subs_imm3 == h) ? r2 : r1);
+    jit_alu_imm(jit, add ? JIT_ADD : JIT_SUB, JIT_EAX, d->imm);
+    core_jit_flags(jit, add ? JIT_B : JIT_AE);
+
+    if (i_cmp_imm != h)
+      jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_movs_imm == h)
+  {
+    jit_store_imm(jit, r1, d->imm);
+    jit_store_imm64(jit, JIT_F(flags.nz), d->imm);
+  }
+  else if (i_ands_reg == h || i_eors_reg == h || i_orrs_reg == h || i_tst_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r1);
+    jit_alu(jit, (i_eors_reg == h) ? JIT_XOR : (i_orrs_reg == h) ? JIT_OR : JIT_AND,
+        JIT_EAX, r2);
+    core_jit_flags(jit, -1);
+
+    if (i_tst_reg != h)
+      jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_bics_reg == h || i_mvns_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r2);
+    jit_unary(jit, JIT_NOT, JIT_EAX);
+
+    if (i_bics_reg == h)
+      jit_alu(jit, JIT_AND, JIT_EAX, r1);
+
+    core_jit_flags(jit, -1);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_rsbs_imm == h)
+  {
+    jit_alu_imm(jit, JIT_AND, JIT_EAX, 0);
+    jit_alu(jit, JIT_SUB, JIT_EAX, r2);
+    core_jit_flags(jit, JIT_AE);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_cmp_reg == h || i_cmn_reg == h || (i_cmp_reg4 == h && PC != d->r1 && PC != d->r2))
+  {
+    jit_load(jit, JIT_EAX, r1);
+    jit_alu(jit, (i_cmn_reg == h) ? JIT_ADD : JIT_SUB, JIT_EAX, r2);
+    core_jit_flags(jit, (i_cmn_reg == h) ? JIT_B : JIT_AE);
+  }
+  else if (i_muls_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r1);
+    jit_imul(jit, JIT_EAX, r2);
+    core_jit_flags(jit, -1);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if ((i_add_reg4 == h || i_mov_reg4 == h) && PC != d->r1 && PC != d->r2)
+  {
+    jit_load(jit, JIT_EAX, r2);
+
+    if (i_add_reg4 == h)
+      jit_alu(jit, JIT_ADD, JIT_EAX, r1);
+
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_add_r_sp_imm == h || i_add_sp_imm == h || i_sub_sp_imm == h)
+  {
+    jit_load(jit, JIT_EAX, JIT_R(SP));
+    jit_alu_imm(jit, (i_sub_sp_imm == h) ? JIT_SUB : JIT_ADD, JIT_EAX, d->imm);
+    jit_store(jit, (i_add_r_sp_imm == h) ? r1 : JIT_R(SP), JIT_EAX);
+  }
+  else if (i_sxth_reg == h || i_sxtb_reg == h || i_uxth_reg == h || i_uxtb_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r2);
+    jit_extend(jit, (i_sxth_reg == h) ? JIT_SX_H : (i_sxtb_reg == h) ? JIT_SX_B :
+        (i_uxth_reg == h) ? JIT_ZX_H : JIT_ZX_B, JIT_EAX);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_rev_reg == h)
+  {
+    jit_load(jit, JIT_EAX, r2);
+    jit_bswap(jit, JIT_EAX);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (i_nop == h)
+  {
+  }
+  else if (i_ldr_pc == h && (pc + 4 + d->imm) < core->flash_size)
+  {
+    jit_load64(jit, JIT_R9, JIT_F(ram));
+    jit_mov_imm(jit, JIT_ECX, (pc + 4 + d->imm) & ~3);
+    jit_load_mem(jit, JIT_WORD, JIT_EAX, JIT_R9, JIT_ECX, 1, 0);
+    jit_store(jit, r1, JIT_EAX);
+  }
+  else if (EXEC_MEM_REG == d->exec || EXEC_MEM_IMM == d->exec || EXEC_MEM_SP == d->exec)
+  {
+    jit_load(jit, JIT_ECX, (EXEC_MEM_SP == d->exec) ? JIT_R(SP) : r2);
+
+    if (EXEC_MEM_REG == d->exec)
+      jit_alu(jit, JIT_ADD, JIT_ECX, r3);
+    else
+      jit_alu_imm(jit, JIT_ADD, JIT_ECX, d->imm);
+
+    jit_alu(jit, JIT_CMP, JIT_ECX, JIT_F(mem_size));
+
+    if (i_ldr_reg == h || i_ldr_imm == h || i_ldr_r_sp_imm == h)
+      core_jit_load(jit, d, JIT_WORD, 4, *pending, executed);
+    else if (i_ldrh_reg == h || i_ldrh_imm == h)
+      core_jit_load(jit, d, JIT_ZX_H, 2, *pending, executed);
+    else if (i_ldrsh_reg == h)
+      core_jit_load(jit, d, JIT_SX_H, 2, *pending, executed);
+    else if (i_ldrb_reg == h || i_ldrb_imm == h)
+      core_jit_load(jit, d, JIT_ZX_B, 1, *pending, executed);
+    else if (i_ldrsb_reg == h)
+      core_jit_load(jit, d, JIT_SX_B, 1, *pending, executed);
+    else if (i_str_reg == h || i_str_imm == h || i_str_r_sp_imm == h)
+      core_jit_store(jit, d, 32, *pending, executed);
+    else if (i_strh_reg == h || i_strh_imm == h)
+      core_jit_store(jit, d, 16, *pending, executed);
+    else
+      core_jit_store(jit, d, 8, *pending, executed);
+  }
+  else if (i_b_imm == h)
+  {
+    *pending += d->imm;
+  }
+  else if (i_b_c_imm == h && d->r1 < 8)
+  {
+    int label;
+
+    jit_add_imm(jit, JIT_R(PC), *pending + 2);
+    *pending = -2;
+
+    if (d->r1 < 2)
+    {
+      jit_load(jit, JIT_EAX, JIT_F(flags.nz));
+      jit_test(jit, JIT_EAX);
+      label = jit_jcc(jit, (d->r1 & 1) ? JIT_E : JIT_NE);
+    }
+    else if (d->r1 >= 4 && d->r1 < 6)
+    {
+      jit_load64(jit, JIT_EAX, JIT_F(flags.nz));
+      jit_test64(jit, JIT_EAX);
+      label = jit_jcc(jit, (d->r1 & 1) ? JIT_S : JIT_NS);
+    }
+    else
+    {
+      core_jit_explicit(jit);
+      jit_load8(jit, JIT_EAX, (d->r1 < 4) ? JIT_F(flags.c) : JIT_F(flags.v));
+      jit_test(jit, JIT_EAX);
+      label = jit_jcc(jit, (d->r1 & 1) ? JIT_NE : JIT_E);
+    }
+
+    jit_add_imm(jit, JIT_R(PC), d->imm);
+    jit_patch(jit, label);
+  }
+  else
+  {
+    return false;
+  }
+
+  *pending += 2;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void core_jit_translate(core_t *core, block_t *block)
+{
+  uint32_t pc = block->addr;
+  int pending = 0;
+  jit_t jit;
+
+  if (DEBUG_CORE || !jit_begin(&jit))
+    return;
+
+  jit_enter(&jit);
+
+  for (int i = 0; i < block->count; i++)
+  {
+    decoded_t *d = &block->code[i];
+    int size = (FMT_32BIT == hash[core->flash[pc >> 1]]->format) ? 4 : 2;
+
+    // The first instruction is executed by the interpreter
+    if (i > 0 && !core_jit_native(core, &jit, d, hash[core->flash[pc >> 1]]->handler,
+        pc, &pending, i - 1))
+    {
+      if (pending)
+        jit_add_imm(&jit, JIT_R(PC), pending);
+
+      pending = 0;
+
+      jit_call(&jit, core_jit_step, d);
+      jit_test8(&jit, JIT_EAX);
+      core_jit_exit(&jit, JIT_E, 0, i - 1);
+
+#ifndef DETECT_FLASH_WRITES
+      jit_cmp_abs(&jit, &block->addr, BLOCK_INVALID);
+      core_jit_exit(&jit, JIT_E, 0, i);
+#endif
+    }
+
+    pc += size;
+  }
+
+  if (pending)
+    jit_add_imm(&jit, JIT_R(PC), pending);
+
+  jit_leave(&jit, block->count - 1);
+
+  block->native = (int (*)(core_t *))jit_end(&jit);
+}
+
+#endif
+
+#if defined(USE_JIT) || defined(USE_AOT)
+//-----------------------------------------------------------------------------
+static inline int core_native_run(core_t *core, block_t *block)
+{
+  if (NULL == block->native)
+  {
+#ifdef USE_JIT
+    if (block->heat < JIT_THRESHOLD)
+    {
+      block->heat++;
+      return -1;
+    }
+
+    if (JIT_THRESHOLD == block->heat++)
+      core_jit_translate(core, block);
+
+    if (NULL == block->native)
+      return -1;
+#else
+    return -1;
+#endif
+  }
+
+  return block->native(core);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static void core_halt(core_t *core)
+{
+  // Branch to self. The state does not change until an interrupt is taken,
+  // so the core sleeps like on WFI. Masked interrupts and an empty enable
+  // mask can only be changed by the core itself, in that case it never wakes.
+  // SysTick is always enabled, but only wraps with TICKINT make it pending.
+  queue_remove(&g_part->active, core);
+  core->sleeping = true;
+
+  if (!core->pm || core->ipsr ||
+      (0 == (core->irq_en & ~(1u << CORE_IRQ_SYS_TICK)) && !core->ext->tick_wake))
+  {
+    LOG_DBG(core, "warning: halted at 0x%08x", core->r[PC]);
+    core->halted = true;
+  }
+  else
+  {
+    queue_add(&g_part->sleeping, core);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void core_block_run(core_t *core)
+{
+  block_t *first = core_block_lookup(core);
+  block_t *block = first;
+  decoded_t *d = &block->code[0];
+  int count = 1;
+  int i = 1;
+
+  if (first->halt && !DEBUG_CORE)
+  {
+    core_halt(core);
+    return;
+  }
+
+  core->run_busy = 0;
+  core->r[PC] += 2;
+  d->handler(core, d);
+  STATS_EXEC(core, d, 1);
+
+  if (block->ends || core->run_busy)
+    goto done;
+
+  memcpy(core->ext->saved_r, core->r, sizeof(core->r));
+  core->ext->saved_flags = core->flags;
+  core->undo_count = 0;
+  core->logging = true;
+
+  while (1)
+  {
+    for (; i < block->count && count < CORE_RUN_LIMIT; i++)
+    {
+#if defined(USE_JIT) || defined(USE_AOT)
+      if (1 == i && (count + block->count - 1) <= CORE_RUN_LIMIT)
+      {
+        int executed = core_native_run(core, block);
+
+        if (executed >= 0)
+        {
+          CORE_STATS(core, native_runs);
+          CORE_STATS_ADD(core, native, executed);
+          count += executed;
+          i += executed;
+
+          if (i < block->count)
+            goto done;
+
+          break;
+        }
+      }
+#endif
+
+      d = &block->code[i];
+
+      if (!core_can_continue(core, d))
+        goto done;
+
+      core->r[PC] += 2;
+
+      if (block->fused && block->fused[i] && count <= CORE_RUN_LIMIT - FUSE_MAX)
+      {
+        int executed = block->fused[i](core, d);
+
+        CORE_STATS(core, fused);
+        STATS_EXEC(core, d, executed);
+        count += executed;
+        i += executed - 1;
+      }
+      else
+      {
+        d->handler(core, d);
+        STATS_EXEC(core, d, 1);
+        count++;
+      }
+
+#ifndef DETECT_FLASH_WRITES
+      if (BLOCK_INVALID == block->addr)
+        goto done;
+#endif
+    }
+
+    if (i < block->count || count == CORE_RUN_LIMIT || core->r[PC] >= core->flash_size)
+      break;
+
+    block = core_block_chain(core, block);
+    i = 0;
+
+    if (block->delay && !DEBUG_CORE)
+    {
+      int executed = core_delay_run(core, block);
+
+      CORE_STATS_ADD(core, delay, executed);
+      count += executed;
+
+      if (executed)
+        goto done;
+    }
+  }
+
+done:
+  // Short runs do not pay off the state saving, execute this block one
+  // instruction at a time for a while. The same applies to runs that keep
+  // stopping at their own start, this may be a polling loop to park.
+  if (count < RUN_MIN_SIZE)
+  {
+    ((image_t *)core->image)->backoff[first->addr >> 1] = RUN_BACKOFF;
+  }
+  else if (core->r[PC] == first->addr)
+  {
+    image_t *image = (image_t *)core->image;
+
+    if (PARK_THRESHOLD == ++image->poll[first->addr >> 1])
+    {
+      image->poll[first->addr >> 1] = 0;
+      image->backoff[first->addr >> 1] = RUN_BACKOFF;
+    }
+  }
+
+  core->logging = false;
+  core->run_size = count + core->run_busy;
+  core->run_cycle = 1;
+}
+
+//-----------------------------------------------------------------------------
+static void core_block_rollback(core_t *core)
+{
+  uint32_t *ram = (uint32_t *)core->ram;
+
+  for (int i = core->undo_count - 1; i >= 0; i--)
+    ram[core->ext->undo_addr[i] >> 2] = core->ext->undo_data[i];
+
+  memcpy(core->r, core->ext->saved_r, sizeof(core->r));
+  core->flags = core->ext->saved_flags;
+  CORE_STATS_ADD(core, rollback, core->run_size - core->run_cycle);
+
+  // The first instruction is never rolled back, it may have accessed
+  // peripherals. The rest of the run only touched the core state.
+  for (int i = 1; i < core->run_cycle; i++)
+  {
+    decoded_t *d = &((decoded_t *)core->decoded)[core->r[PC] >> 1];
+
+    core->r[PC] += 2;
+    d->handler(core, d);
+  }
+}
+
+#ifndef DETECT_FLASH_WRITES
+//-----------------------------------------------------------------------------
+static void core_flash_write(core_t *core, uint32_t addr)
+{
+  image_t *image = (image_t *)core->image;
+  decoded_t *decoded = (decoded_t *)core->decoded;
+  int first = (addr >> 1) - 1;
+  int last = (addr + 3) >> 1;
+
+  // Each image is private when flash writes are allowed. A write may affect
+  // the 32-bit instruction starting at the previous halfword.
+  for (int i = (first < 0) ? 0 : first; i <= last && i < (int)image->size / 2; i++)
+    decoded[i].handler = i_decode;
+
+  for (uint32_t i = 0; i < image->size / 2; i++)
+  {
+    block_t *block = image->blocks[i];
+
+    if (block && (addr + 4) > block->addr && addr < (block->addr + block->size))
+    {
+      block->addr = BLOCK_INVALID;
+      image->blocks[i] = NULL;
+    }
+  }
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static inline decoded_t *core_decoded(core_t *core, uint32_t pc)
+{
+  decoded_t *d = &((decoded_t *)core->decoded)[pc >> 1];
+
+  if (i_decode == d->handler)
+    core_decode(core, pc, d);
+
+  return d;
+}
+
+//-----------------------------------------------------------------------------
+static bool core_park_head(core_t *core)
+{
+  decoded_t *d = core_decoded(core, core->r[PC]);
+  handler_t *h = hash[core->flash[core->r[PC] >> 1]]->handler;
+  uint32_t addr;
+  uint8_t id;
+
+  if (i_hook == d->handler)
+    return false;
+
+  if (i_ldr_imm == h)
+    addr = core->r[d->r2] + d->imm;
+  else if (i_ldr_reg == h)
+    addr = core->r[d->r2] + core->r[d->r3];
+  else
+    return false;
+
+  // Only registers that can't change on read and are updated by events or
+  // by writes from other nodes
+  id = addr >> SOC_PERIPHERAL_OFFSET;
+
+  if (addr < core->mem_size || (addr & 3) || (SOC_ID_TRX != id &&
+      (id < SOC_ID_SYS_TIMER_0 || id > SOC_ID_SYS_TIMER_3)))
+    return false;
+
+  core->ext->park_addr = addr;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static bool core_park_allowed(decoded_t *d, handler_t *h)
+{
+  switch (d->exec)
+  {
+    case EXEC_ANY:
+      return i_bkpt_imm != h && i_sev != h;
+
+    case EXEC_BRANCH:
+    case EXEC_BX:
+    case EXEC_MEM_PC:
+    case EXEC_POP:
+      return true;
+
+    case EXEC_MEM_REG:
+      return i_ldr_reg == h || i_ldrh_reg == h || i_ldrb_reg == h ||
+          i_ldrsb_reg == h || i_ldrsh_reg == h;
+
+    case EXEC_MEM_IMM:
+      return i_ldr_imm == h || i_ldrh_imm == h || i_ldrb_imm == h;
+
+    case EXEC_MEM_SP:
+      return i_ldr_r_sp_imm == h;
+
+    case EXEC_MEM_LIST:
+      return i_ldm == h;
+  }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+static bool core_park(core_t *core)
+{
+  uint32_t head = core->r[PC];
+  uint32_t r[16];
+  flags_t flags;
+  bool n, z, c, v;
+  int count;
+
+  if (!core_park_head(core))
+    return false;
+
+  memcpy(r, core->r, sizeof(r));
+  flags = core->flags;
+
+  // Run one iteration of the loop, it must only read RAM and the polled
+  // register and must end in the same state it started in
+  for (count = 0; count < CORE_PARK_SIZE; count++)
+  {
+    uint32_t pc = core->r[PC];
+    decoded_t *d;
+    handler_t *h;
+
+    if (count > 0 && pc == head)
+      break;
+
+    if (pc >= core->flash_size)
+      break;
+
+    d = core_decoded(core, pc);
+    h = hash[core->flash[pc >> 1]]->handler;
+
+    if (FMT_32BIT == hash[core->flash[pc >> 1]]->format)
+      h = d->handler;
+
+    if (count > 0 && (!core_park_allowed(d, h) || !core_can_continue(core, d)))
+      break;
+
+    memcpy(core->ext->park_r[count], core->r, sizeof(core->r));
+    core->ext->park_flags[count] = core->flags;
+
+    core->r[PC] += 2;
+    d->handler(core, d);
+  }
 
-    i1 = ~(j1 ^ s) & 1;
-    i2 = ~(j2 ^ s) & 1;
+  n = flag_n(core);
+  z = flag_z(core);
+  c = flag_c(core);
+  v = flag_v(core);
 
-    target = (s << 24) | (i1 << 23) | (i2 << 22) | (imm10 << 12) | (imm11 << 1);
-    target |= s ? 0xff000000 : 0x00000000;
-    target += core->r[PC];
+  if (core->r[PC] != head || 0 != memcmp(r, core->r, sizeof(r)))
+    count = 0;
 
-    CORE_DBG(core, "bl\t0x%08x", target);
+  memcpy(core->r, r, sizeof(r));
+  core->flags = flags;
 
-    core->r[LR] = core->r[PC] | 1;
-    core->r[PC] = target;
-  }
+  if (0 == count || n != flag_n(core) || z != flag_z(core) ||
+      c != flag_c(core) || v != flag_v(core))
+    return false;
 
-  else if (0xf3ef8000 == (opcode & 0xfffff000)) // MRS  Rd, spec_reg
-  {
-    int rd = GET32_RD(opcode);
-    uint32_t imm = GET32_IMM8(opcode);
-    uint32_t immh = (imm >> 3) & 0x1f;
-    uint32_t imml = imm & 0x7;
+  core->parked = true;
+  core->ext->park_value = read_w(core, core->ext->park_addr);
+  core->ext->park_period = count;
+  core->ext->park_cycle = g_part->cycle;
+  core->park_clk = g_part->cycle;
+  core->ext->park_next = g_part->parked;
+  g_part->parked = core;
 
-    CORE_DBG(core, "mrs\tr%d, 0x%02x", rd, imm);
+  return true;
+}
 
-    core->r[rd] = 0;
+//-----------------------------------------------------------------------------
+static void core_unpark(core_t *core)
+{
+  uint64_t cycle = g_part->cycle;
+  int phase;
 
-    if (0 == immh)
-    {
-      if (imm & 1)
-        core->r[rd] |= core->ipsr;
+  // Resume on the next cycle the core is going to be clocked at
+  if (core->park_clk == g_part->cycle)
+    cycle++;
 
-      if (0 == (imm & 4))
-        core->r[rd] |= (core->n << BIT_N) | (core->z << BIT_Z) | (core->c << BIT_C) | (core->v << BIT_V);
-    }
-    else if (1 == immh)
-    {
-      if (0 == imml || 1 == imml)
-        core->r[rd] = core->r[SP];
-    }
-    else if (2 == immh)
+  phase = (cycle - core->ext->park_cycle) % core->ext->park_period;
+  CORE_STATS_ADD(core, parked, cycle - core->ext->park_cycle);
+
+  memcpy(core->r, core->ext->park_r[phase], sizeof(core->r));
+  core->flags = core->ext->park_flags[phase];
+  core->parked = false;
+
+  for (core_t **p = (core_t **)&g_part->parked; *p; p = (core_t **)&(*p)->ext->park_next)
+  {
+    if (*p == core)
     {
-      if (0 == imml)
-        core->r[rd] = core->pm;
+      *p = core->ext->park_next;
+      break;
     }
   }
+}
+
+//-----------------------------------------------------------------------------
+void core_park_check(void)
+{
+  core_t *core = g_part->parked;
 
-  else if (0xf3808800 == (opcode & 0xfff0ff00)) // MSR  spec_reg, Ra
+  while (core)
   {
-    int ra = GET32_RA(opcode);
-    uint32_t imm = GET32_IMM8(opcode);
-    uint32_t immh = (imm >> 3) & 0x1f;
-    uint32_t imml = imm & 0x7;
-    uint32_t rav = core->r[ra];
+    core_t *next = core->ext->park_next;
 
-    CORE_DBG(core, "msr\t0x%02x, r%d", imm, ra);
+    if (read_w(core, core->ext->park_addr) != core->ext->park_value)
+      core_unpark(core);
 
-    if (0 == immh)
-    {
-      if (0 == (imm & 4))
-      {
-        core->n = (rav & (1 << BIT_N)) > 0;
-        core->z = (rav & (1 << BIT_Z)) > 0;
-        core->c = (rav & (1 << BIT_C)) > 0;
-        core->v = (rav & (1 << BIT_V)) > 0;
-      }
-    }
-    else if (1 == immh)
-    {
-      if (0 == imml || 1 == imml)
-        core->r[SP] = rav & 0xfffffffc;
-    }
-    else if (2 == immh)
-    {
-      if (0 == imml)
-        core->pm = rav & 1;
-    }
+    core = next;
   }
+}
 
-  else if (0xf7f0a000 == (opcode & 0xfff0f000)) // UDF.W  #imm16
-  {
-    uint32_t imm = GET32_IMM16(opcode);
+#ifdef USE_STATS
+//-----------------------------------------------------------------------------
+static const char *core_stats_name(int index)
+{
+  _Static_assert(ARRAY_SIZE(instructions) + ARRAY_SIZE(instructions_32bit) < CORE_STATS_INSTR,
+      "CORE_STATS_INSTR is too small");
 
-    CORE_DBG(core, "udf.w\t0x%04x", imm);
-    // TODO: interrupt
+  if (index < (int)ARRAY_SIZE(instructions))
+    return instructions[index].name;
 
-    error("%s: udf.w not implemented at 0x%08x", core->name, core->r[PC]-2);
-  }
+  index -= ARRAY_SIZE(instructions);
 
-  else if (0xf3bf8f40 == (opcode & 0xfffffff0)) // DSB  #imm4
-  {
-    uint32_t imm = GET32_IMM4(opcode);
+  if (index < (int)ARRAY_SIZE(instructions_32bit))
+    return instructions_32bit[index].name;
 
-    CORE_DBG(core, "dsb\t%d", imm);
-  }
+  return undefined.name;
+}
+
+//-----------------------------------------------------------------------------
+static void core_stats_dump(const char *name, core_stats_t *stats)
+{
+  int order[CORE_STATS_INSTR];
+  uint64_t total = 0;
 
-  else if (0xf3bf8f50 == (opcode & 0xfffffff0)) // DMB  #imm4
+  for (int i = 0; i < CORE_STATS_INSTR; i++)
   {
-    uint32_t imm = GET32_IMM4(opcode);
+    int j = i;
+
+    for (; j > 0 && stats->instr[order[j-1]] < stats->instr[i]; j--)
+      order[j] = order[j-1];
 
-    CORE_DBG(core, "dmb\t%d", imm);
+    order[j] = i;
+    total += stats->instr[i];
   }
 
-  else if (0xf3bf8f60 == (opcode & 0xfffffff0)) // ISB  #imm4
-  {
-    uint32_t imm = GET32_IMM4(opcode);
+  printf("Statistics for %s:\n", name);
+  printf("  dispatched %"PRIu64", fused %"PRIu64", native %"PRIu64" in %"PRIu64" runs\n",
+      total, stats->fused, stats->native, stats->native_runs);
+  printf("  skipped in delay loops %"PRIu64", rolled back %"PRIu64", parked cycles %"PRIu64"\n",
+      stats->delay, stats->rollback, stats->parked);
+  printf("  branches taken %"PRIu64", not taken %"PRIu64"\n", stats->taken, stats->not_taken);
+  printf("  exceptions %"PRIu64", tail-chained %"PRIu64"\n", stats->exceptions, stats->chained);
 
-    CORE_DBG(core, "isb\t%d", imm);
+  for (int i = 0; i < CORE_STATS_MMIO; i++)
+  {
+    if (stats->mmio[i])
+      printf("  peripheral 0x%02x accesses %"PRIu64"\n", i, stats->mmio[i]);
   }
 
-  else
+  for (int i = 0; i < CORE_STATS_INSTR && stats->instr[order[i]]; i++)
   {
-    i_undefined(core);
-  }
-}
-
-//-----------------------------------------------------------------------------
-static instr_t instructions[] =
-{
-  { i_lsls_imm,		0xf800, 0x0000 },
-  { i_lsrs_imm,		0xf800, 0x0800 },
-  { i_asrs_imm,		0xf800, 0x1000 },
-  { i_adds_reg,		0xfe00, 0x1800 },
-  { i_subs_reg,		0xfe00, 0x1a00 },
-  { i_adds_imm3,	0xfe00, 0x1c00 },
-  { i_subs_imm3,	0xfe00, 0x1e00 },
-  { i_movs_imm,		0xf800, 0x2000 },
-  { i_cmp_imm,		0xf800, 0x2800 },
-  { i_adds_imm8,	0xf800, 0x3000 },
-  { i_subs_imm8,	0xf800, 0x3800 },
-
-  { i_ands_reg,		0xffc0, 0x4000 },
-  { i_eors_reg,		0xffc0, 0x4040 },
-  { i_lsls_reg,		0xffc0, 0x4080 },
-  { i_lsrs_reg,		0xffc0, 0x40c0 },
-  { i_asrs_reg,		0xffc0, 0x4100 },
-  { i_adcs_reg,		0xffc0, 0x4140 },
-  { i_sbcs_reg,		0xffc0, 0x4180 },
-  { i_rors_reg,		0xffc0, 0x41c0 },
-  { i_tst_reg,		0xffc0, 0x4200 },
-  { i_rsbs_imm,		0xffc0, 0x4240 },
-  { i_cmp_reg,		0xffc0, 0x4280 },
-  { i_cmn_reg,		0xffc0, 0x42c0 },
-  { i_orrs_reg,		0xffc0, 0x4300 },
-  { i_muls_reg,		0xffc0, 0x4340 },
-  { i_bics_reg,		0xffc0, 0x4380 },
-  { i_mvns_reg,		0xffc0, 0x43c0 },
-
-  { i_add_reg4,		0xff00, 0x4400 },
-  { i_cmp_reg4,		0xff00, 0x4500 },
-  { i_mov_reg4,		0xff00, 0x4600 },
-  { i_bx_reg4,		0xff87, 0x4700 },
-  { i_blx_reg4,		0xff87, 0x4780 },
-
-  { i_ldr_pc,		0xf800, 0x4800 },
-
-  { i_str_reg,		0xfe00, 0x5000 },
-  { i_strh_reg,		0xfe00, 0x5200 },
-  { i_strb_reg,		0xfe00, 0x5400 },
-  { i_ldrsb_reg,	0xfe00, 0x5600 },
-  { i_ldr_reg,		0xfe00, 0x5800 },
-  { i_ldrh_reg,		0xfe00, 0x5a00 },
-  { i_ldrb_reg,		0xfe00, 0x5c00 },
-  { i_ldrsh_reg,	0xfe00, 0x5e00 },
-  { i_str_imm,		0xf800, 0x6000 },
-  { i_ldr_imm,		0xf800, 0x6800 },
-  { i_strb_imm,		0xf800, 0x7000 },
-  { i_ldrb_imm,		0xf800, 0x7800 },
-  { i_strh_imm,		0xf800, 0x8000 },
-  { i_ldrh_imm,		0xf800, 0x8800 },
-  { i_str_r_sp_imm,	0xf800, 0x9000 },
-  { i_ldr_r_sp_imm,	0xf800, 0x9800 },
-
-  { i_add_r_pc_imm,	0xf800, 0xa000 },
-  { i_add_r_sp_imm,	0xf800, 0xa800 },
-
-  { i_add_sp_imm,	0xff80, 0xb000 },
-  { i_sub_sp_imm,	0xff80, 0xb080 },
-  { i_sxth_reg,		0xffc0, 0xb200 },
-  { i_sxtb_reg,		0xffc0, 0xb240 },
-  { i_uxth_reg,		0xffc0, 0xb280 },
-  { i_uxtb_reg,		0xffc0, 0xb2c0 },
-  { i_push,		0xfe00, 0xb400 },
-  { i_pop,		0xfe00, 0xbc00 },
-  { i_cpsie,		0xffff, 0xb662 },
-  { i_cpsid,		0xffff, 0xb672 },
-  { i_rev_reg,		0xffc0, 0xba00 },
-  { i_rev16_reg,	0xffc0, 0xba40 },
-  { i_revsh_reg,	0xffc0, 0xbac0 },
-  { i_bkpt_imm,		0xff00, 0xbe00 },
-  { i_nop,		0xffff, 0xbf00 },
-  { i_yield,		0xffff, 0xbf10 },
-  { i_wfe,		0xffff, 0xbf20 },
-  { i_wfi,		0xffff, 0xbf30 },
-  { i_sev,		0xffff, 0xbf40 },
-
-  { i_stm,		0xf800, 0xc000 },
-  { i_ldm,		0xf800, 0xc800 },
-
-  { i_b_c_imm,		0xf000, 0xd000 },
-  { i_udf_imm,		0xff00, 0xde00 },
-  { i_svc_imm,		0xff00, 0xdf00 },
-
-  { i_b_imm,		0xf800, 0xe000 },
-
-  { i_32bit,		0xf800, 0xf000 },
-};
-
-//-----------------------------------------------------------------------------
-static bool is_more_specific(instr_t *i1, instr_t *i2)
-{
-  return ((i1->value & i2->mask) == i2->value);
+    printf("  %-14s %14"PRIu64" %6.2f%%\n", core_stats_name(order[i]),
+        stats->instr[order[i]], stats->instr[order[i]] * 100.0 / total);
+  }
 }
 
 //-----------------------------------------------------------------------------
-static uint16_t distribute_bits(uint16_t d, uint16_t n)
+void core_stats_print(core_t *core)
 {
-  uint16_t res = 0;
-  int in, id;
+  uint64_t *src = (uint64_t *)&core->ext->stats;
+  uint64_t *dst = (uint64_t *)&stats_total;
 
-  for (id = 0, in = 0; id < 16; id++)
-  {
-    if (0 == (d & (1 << id)))
-    {
-      if (n & (1 << in))
-        res |= 1 << id;
-      in++;
-    }
-  }
+  // All the counters are 64-bit
+  for (int i = 0; i < (int)(sizeof(core_stats_t) / sizeof(uint64_t)); i++)
+    dst[i] += src[i];
 
-  return res;
+  core_stats_dump(core->name, &core->ext->stats);
 }
 
 //-----------------------------------------------------------------------------
-static int count_zeros(uint16_t d)
+void core_stats_print_total(void)
 {
-  int i, cnt = 0;
+  int top[STATS_OPCODES];
+  int count = 0;
+  uint64_t total = 0;
 
-  for (i = 0; i < 16; i++)
+  core_stats_dump("all nodes", &stats_total);
+
+  for (int i = 0; i < HASH_TABLE_SIZE; i++)
   {
-    if (0 == (d & (1 << i)))
-      cnt++;
+    int j;
+
+    total += stats_opcodes[i];
+
+    if (0 == stats_opcodes[i])
+      continue;
+
+    if (count < STATS_OPCODES)
+      count++;
+    else if (stats_opcodes[top[count-1]] >= stats_opcodes[i])
+      continue;
+
+    for (j = count - 1; j > 0 && stats_opcodes[top[j-1]] < stats_opcodes[i]; j--)
+      top[j] = top[j-1];
+
+    top[j] = i;
   }
 
-  return cnt;
-} 
+  printf("Most frequent opcodes:\n");
+
+  for (int i = 0; i < count; i++)
+  {
+    const instr_t *instr = hash[top[i]];
+
+    printf("  0x%04x %-14s %14"PRIu64" %6.2f%%\n", top[i],
+        (FMT_32BIT == instr->format) ? "32-bit" : instr->name,
+        stats_opcodes[top[i]], stats_opcodes[top[i]] * 100.0 / total);
+  }
+}
+#endif
 
 //-----------------------------------------------------------------------------
 void core_setup(void)
@@ -1809,7 +3991,7 @@ void core_setup(void)
   for (int i = 0; i < HASH_TABLE_SIZE; i++)
   {
     hash_index[i] = -1;
-    hash[i] = i_undefined;
+    hash[i] = &undefined;
   }
 
   for (int i = 0; i < (int)ARRAY_SIZE(instructions); i++)
@@ -1832,10 +4014,29 @@ void core_setup(void)
     if (hash_index[i] == -1)
       free++;
     else
-      hash[i] = instructions[hash_index[i]].handler;
+      hash[i] = &instructions[hash_index[i]];
   }
 }
 
+//-----------------------------------------------------------------------------
+core_t *core_alloc(void)
+{
+  core_t *core;
+
+  if (CORE_POOL_SIZE == pool_used)
+  {
+    uintptr_t mem = (uintptr_t)sim_malloc(CORE_POOL_SIZE * sizeof(core_t) + CORE_LINE_SIZE);
+
+    pool = (core_t *)((mem + CORE_LINE_SIZE - 1) & ~(uintptr_t)(CORE_LINE_SIZE - 1));
+    pool_used = 0;
+  }
+
+  core = &pool[pool_used++];
+  core->ext = sim_malloc(sizeof(core_ext_t));
+
+  return core;
+}
+
 //-----------------------------------------------------------------------------
 void core_init(core_t *core)
 {
@@ -1845,49 +4046,437 @@ void core_init(core_t *core)
     core->r[i] = 0;
 
   core->irqs = 0;
-  core->irq_en = 0;
+  core->irq_en = 1u << CORE_IRQ_SYS_TICK;
   core->ipsr = 0;
   core->pm = true;
   core->sleeping = false;
+  core->halted = false;
+  core->chained = false;
+  set_flags(core, false, false, false, false);
+
+  memset(core->ext->map, 0, sizeof(core->ext->map));
+  core->ext->regions_count = 0;
+  core->ext->event = false;
+  core->ext->sleep_on_exit = false;
+  core->ext->tick_wake = false;
+  core->ext->ahead_backoff = 1;
+  core_map(core, 0, core->flash_size, core->ram, false);
+  core_map(core, core->flash_size, core->mem_size - core->flash_size,
+      core->ram + core->flash_size, true);
 
   core->r[SP] = ram[0];
   core->r[PC] = ram[1];
   core->flash = (uint16_t *)core->ram;
+  core->image = core_image(core);
+  core->decoded = ((image_t *)core->image)->decoded;
+  core->run_size = 0;
+  core->run_cycle = 0;
+  core->run_busy = 0;
+  core->ahead = 0;
+  core->ahead_skip = 0;
+  core->logging = false;
+  core->parked = false;
+}
+
+//-----------------------------------------------------------------------------
+void core_map(core_t *core, uint32_t addr, uint32_t size, void *mem, bool writable)
+{
+  core_page_t *region = &core->ext->regions[core->ext->regions_count];
+
+  if (addr & (CORE_PAGE_SIZE - 1))
+    error("%s: unaligned memory region @ 0x%08x", core->name, addr);
+
+  if (CORE_REGIONS == core->ext->regions_count)
+    error("%s: too many memory regions", core->name);
 
+  for (int i = 0; i < core->ext->regions_count; i++)
+  {
+    if (addr < (core->ext->regions[i].addr + core->ext->regions[i].size) &&
+        core->ext->regions[i].addr < (addr + size))
+      error("%s: memory region @ 0x%08x conflicts with 0x%08x", core->name,
+          addr, core->ext->regions[i].addr);
+  }
+
+  region->addr = addr;
+  region->size = size;
+  region->wsize = writable ? size : 0;
+  region->mem = mem;
+  core->ext->regions_count++;
+
+  for (uint32_t offset = 0; offset < size; offset += CORE_PAGE_SIZE)
+    core_page_fill(core, region, addr + offset);
 }
 
 //-----------------------------------------------------------------------------
-void core_clk(core_t *core)
+static void core_trace(core_t *core, uint32_t *r)
 {
-  if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr)
+  trace_record_t *record = trace_next((trace_t *)core->ext->trace);
+  uint32_t pc = r[PC] & ~1u;
+  uint32_t opcode = core->flash[pc >> 1];
+
+  if ((opcode & 0xf800) >= 0xe800)
+    opcode = (opcode << 16) | core->flash[(pc >> 1) + 1];
+
+  record->cycle = g_part->cycle;
+  record->pc = pc;
+  record->opcode = opcode;
+  record->value = 0;
+  record->reg = TRACE_NONE;
+  record->flags = (flag_n(core) << 3) | (flag_z(core) << 2) | (flag_c(core) << 1) | flag_v(core);
+  record->reserved = 0;
+
+  for (int i = 0; i < PC; i++)
+  {
+    if (r[i] == core->r[i])
+      continue;
+
+    if (TRACE_NONE == record->reg)
+    {
+      record->reg = i;
+      record->value = core->r[i];
+    }
+    else
+    {
+      record->flags |= TRACE_MORE;
+      break;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void core_trace_exception(core_t *core)
+{
+  trace_record_t *record = trace_next((trace_t *)core->ext->trace);
+
+  record->cycle = g_part->cycle;
+  record->pc = core->r[PC] & ~1u;
+  record->opcode = 0;
+  record->value = core->ipsr;
+  record->reg = TRACE_EXCEPTION;
+  record->flags = 0;
+  record->reserved = 0;
+}
+
+//-----------------------------------------------------------------------------
+static void core_trace_step(core_t *core)
+{
+  uint32_t r[16];
+  decoded_t local;
+  decoded_t *d = &local;
+
+  // Traced cores do not use block runs, each instruction is executed and
+  // recorded on its own cycle
+  memcpy(r, core->r, sizeof(r));
+
+  if (core->r[PC] < core->flash_size)
+    d = core_decoded(core, core->r[PC]);
+  else
+    core_decode(core, core->r[PC], d);
+
+  core->r[PC] += 2;
+  d->handler(core, d);
+  STATS_EXEC(core, d, 1);
+
+  core_trace(core, r);
+}
+
+//-----------------------------------------------------------------------------
+bool core_clk(core_t *core)
+{
+  if (core->ahead)
+  {
+    core->ahead--;
+    return true;
+  }
+  else if (core->parked)
+  {
+    core->park_clk = g_part->cycle;
+    return true;
+  }
+  else if (core->run_cycle < core->run_size)
+  {
+    if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr &&
+        core->run_cycle > core->run_busy)
+    {
+      core_block_rollback(core);
+      core->run_size = 0;
+      core->run_cycle = 0;
+      core_exception_enter(core);
+
+      if (core->traced)
+        core_trace_exception(core);
+    }
+    else
+    {
+      core->run_cycle++;
+    }
+  }
+  else if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr)
   {
     core_exception_enter(core);
+
+    if (core->traced)
+      core_trace_exception(core);
+  }
+  else if (core->traced)
+  {
+    core_trace_step(core);
+  }
+  else if (core->r[PC] < core->flash_size)
+  {
+    image_t *image = (image_t *)core->image;
+    uint32_t index = core->r[PC] >> 1;
+
+    if (image->backoff[index])
+    {
+      decoded_t *d = &image->decoded[index];
+
+      image->backoff[index]--;
+
+      if (!DEBUG_CORE && 0 == (image->backoff[index] % PARK_THRESHOLD) &&
+          core_park(core))
+        return true;
+
+      core->r[PC] += 2;
+      d->handler(core, d);
+      STATS_EXEC(core, d, 1);
+    }
+    else
+    {
+      core_block_run(core);
+    }
   }
   else
   {
-    core->opcode = core->flash[core->r[PC] >> 1];
+    decoded_t d;
+
+    core_decode(core, core->r[PC], &d);
     core->r[PC] += 2;
-    hash[core->opcode](core);
+    d.handler(core, &d);
+    STATS_EXEC(core, &d, 1);
   }
+
+  return core->run_cycle < core->run_size;
 }
 
 //-----------------------------------------------------------------------------
-void core_irq_set(core_t *core, int irq)
+static inline bool core_can_run(core_t *core)
+{
+  if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr)
+    return false;
+
+  if (core->r[PC] >= core->flash_size)
+    return false;
+
+  return core_can_continue(core, core_decoded(core, core->r[PC]));
+}
+
+//-----------------------------------------------------------------------------
+int core_run(core_t *core, int cycles)
+{
+  uint64_t cycle = g_part->cycle;
+  int executed = min(core->ahead, cycles);
+
+  core->ahead -= executed;
+
+  if (core->parked)
+  {
+    if (executed < cycles)
+      core->park_clk = g_part->cycle + cycles - 1;
+    return cycles;
+  }
+
+  // Runs the core ahead of the rest of the simulation, stops before anything
+  // that may access peripherals or depend on the external state. The time
+  // follows the core, so parking and log output see its local time.
+  while (executed < cycles)
+  {
+    if (core->run_cycle < core->run_size)
+    {
+      int skip = min(core->run_size - core->run_cycle, cycles - executed);
+
+      if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr)
+        break;
+
+      core->run_cycle += skip;
+      executed += skip;
+    }
+    else if (core_can_run(core))
+    {
+      g_part->cycle = cycle + executed;
+      core_clk(core);
+      executed++;
+
+      if (core->sleeping || core->parked)
+        break;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  g_part->cycle = cycle;
+
+  return executed;
+}
+
+//-----------------------------------------------------------------------------
+int core_run_ahead(core_t *core, int cycles)
 {
+  core_ext_t *ext = core->ext;
+  int executed = 0;
+
   if (core->sleeping)
+    return 0;
+
+  // The core was already clocked in the current cycle, it runs from the
+  // next one and is then skipped until it catches up with the simulation.
+  // A sleeping core is not clocked, it is only woken up after the run.
+  if (cycles > 0)
+  {
+    g_part->cycle++;
+    executed = core_run(core, cycles);
+    g_part->cycle--;
+
+    if (!core->sleeping)
+      core->ahead = executed;
+  }
+
+  // Short runs cost more than they save, the core is most likely polling
+  // a peripheral or waiting for other nodes, so the next attempts are
+  // spaced out.
+  if (executed < AHEAD_MIN_SIZE)
+  {
+    core->ahead_skip = ext->ahead_backoff;
+    ext->ahead_backoff = min(ext->ahead_backoff * 2, AHEAD_BACKOFF);
+  }
+  else
+  {
+    ext->ahead_backoff = 1;
+  }
+
+  return executed;
+}
+
+//-----------------------------------------------------------------------------
+int core_stall(core_t *core)
+{
+  if (core->ahead)
+    return core->ahead;
+
+  if (core->parked)
+    return INT_MAX;
+
+  if ((core->irqs & core->irq_en) && core->pm && 0 == core->ipsr)
+    return 0;
+
+  return core->run_size - core->run_cycle;
+}
+
+//-----------------------------------------------------------------------------
+void core_skip(core_t *core, int cycles)
+{
+  if (core->ahead)
+    core->ahead -= cycles;
+  else if (core->parked)
+    core->park_clk = g_part->cycle + cycles - 1;
+  else
+    core->run_cycle += cycles;
+}
+
+//-----------------------------------------------------------------------------
+void core_sync(core_t *core)
+{
+  // Brings the state in line with the simulation time, the rest of the block
+  // run is executed one instruction at a time
+  if (core->run_cycle < core->run_size && core->run_cycle > core->run_busy)
+  {
+    core_block_rollback(core);
+    core->run_size = core->run_cycle;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void core_wait(core_t *core, int cycles)
+{
+  // Called by peripherals to make the current instruction take longer. The
+  // run ends with this instruction, so there is nothing to roll back.
+  if (cycles > 0)
+  {
+    core->run_busy = cycles;
+    core->run_size = cycles + 1;
+    core->run_cycle = 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void core_image_hook(image_t *image, uint32_t addr, core_hook_t *hook)
+{
+  hook_t *hooks;
+
+  for (int i = 0; i < image->hooks_count; i++)
+  {
+    if (image->hooks[i].addr == addr)
+    {
+      image->hooks[i].hook = hook;
+      return;
+    }
+  }
+
+  hooks = sim_malloc((image->hooks_count + 1) * sizeof(hook_t));
+
+  if (image->hooks)
+  {
+    memcpy(hooks, image->hooks, image->hooks_count * sizeof(hook_t));
+    sim_free(image->hooks);
+  }
+
+  hooks[image->hooks_count].addr = addr;
+  hooks[image->hooks_count].hook = hook;
+  image->hooks = hooks;
+  image->hooks_count++;
+
+  image->decoded[addr >> 1].handler = i_decode;
+}
+
+//-----------------------------------------------------------------------------
+void core_hook(core_t *core, uint32_t addr, core_hook_t *hook)
+{
+  image_t *image = (image_t *)core->image;
+
+  // Hooks belong to the image and apply to all cores running the same
+  // firmware, including the copies of the image made for other threads
+#ifdef DETECT_FLASH_WRITES
+  for (image_t *other = images; other; other = other->next)
+  {
+    if (other != image && core_image_match(other, core))
+      core_image_hook(other, addr, hook);
+  }
+#endif
+
+  core_image_hook(image, addr, hook);
+}
+
+//-----------------------------------------------------------------------------
+void core_irq_set(core_t *core, int irq)
+{
+  if (core->sleeping && !core->halted)
   {
-    soc_t *soc = SOC(core);
-    queue_remove(&g_sim.sleeping, (queue_t *)soc);
-    queue_add(&g_sim.active, (queue_t *)soc);
+    queue_remove(&g_part->sleeping, core);
+    queue_add(&g_part->active, core);
     core->sleeping = false;
   }
 
-  core->irqs |= (1 << irq);
+  if (core->parked)
+    core_unpark(core);
+
+  core->irqs |= (1u << irq);
 }
 
 //-----------------------------------------------------------------------------
 void core_irq_clear(core_t *core, int irq)
 {
-  core->irqs &= ~(1 << irq);
+  core->irqs &= ~(1u << irq);
 }
 
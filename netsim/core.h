@@ -21,41 +21,182 @@
 /*- Includes ----------------------------------------------------------------*/
 #include <stdint.h>
 #include <stdbool.h>
+#include "utils.h"
 
 /*- Definitions -------------------------------------------------------------*/
-#define CORE_RAM_SIZE    128*1024 // Must be a power of 2
-#define CORE_FLASH_SIZE  (CORE_RAM_SIZE / 2)
+#define CORE_FLASH_SIZE  (64*1024) // Default sizes, RAM follows the flash
+#define CORE_RAM_SIZE    (64*1024)
+#define CORE_MEM_LIMIT   (16*1024*1024) // Memory ends below the first peripheral
+#define CORE_RUN_LIMIT   64 // Maximum number of instructions in one block run
+#define CORE_UNDO_SIZE   (CORE_RUN_LIMIT * 9)
+#define CORE_PARK_SIZE   16 // Maximum number of instructions in a parked loop
+#define CORE_PAGE_BITS   12
+#define CORE_PAGE_SIZE   (1 << CORE_PAGE_BITS)
+#define CORE_MAP_SIZE    64 // Must be a power of 2
+#define CORE_REGIONS     4
+#define CORE_LINE_SIZE   64
+#define CORE_POOL_SIZE   256 // Number of cores allocated at once
+#define CORE_STATS_INSTR 128 // Must fit all instruction table entries
+#define CORE_STATS_MMIO  256
+#define CORE_IRQ_SYS_TICK 31 // SysTick is pended as the last line, taken as exception 15
+
+#ifdef USE_STATS
+#define CORE_STATS(core, f)         ((core)->ext->stats.f++)
+#define CORE_STATS_ADD(core, f, n)  ((core)->ext->stats.f += (n))
+#else
+#define CORE_STATS(core, f)
+#define CORE_STATS_ADD(core, f, n)
+#endif
 
 /*- Types -------------------------------------------------------------------*/
+// Condition flags are evaluated lazily. N and Z are taken from the sign and
+// the low word of nz. C and V are either stored directly or, when lazy is
+// set, derived from the operands of the last addition (a + b + carry).
 typedef struct
 {
-  char         *name;
-
-  uint32_t     r[16];
-  bool         n;
-  bool         z;
+  int64_t      nz;
+  uint32_t     a;
+  uint32_t     b;
+  bool         carry;
+  bool         lazy;
   bool         c;
   bool         v;
+} flags_t;
+
+// Directly mapped table of memory pages. Accesses that hit a page go
+// straight to the host memory. Pages are filled in from the mapped regions
+// on a miss, everything else goes to the peripherals.
+typedef struct
+{
+  uint32_t     addr;
+  uint32_t     size;
+  uint32_t     wsize;    // Zero for read-only pages
+  uint8_t      *mem;
+} core_page_t;
+
+#ifdef USE_STATS
+// Instrumentation counters. Instructions are counted when dispatched by the
+// interpreter, the fast paths only count the instructions they cover.
+typedef struct
+{
+  uint64_t     instr[CORE_STATS_INSTR];
+  uint64_t     fused;
+  uint64_t     native;
+  uint64_t     native_runs;
+  uint64_t     delay;
+  uint64_t     rollback;
+  uint64_t     parked;
+  uint64_t     taken;
+  uint64_t     not_taken;
+  uint64_t     exceptions;
+  uint64_t     chained;
+  uint64_t     mmio[CORE_STATS_MMIO];
+} core_stats_t;
+#endif
+
+// State that is not needed on every cycle is kept out of line
+typedef struct
+{
+  uint32_t     undo_addr[CORE_UNDO_SIZE];
+  uint32_t     undo_data[CORE_UNDO_SIZE];
+  uint32_t     saved_r[16];
+  flags_t      saved_flags;
+
+  uint32_t     park_addr;
+  uint32_t     park_value;
+  int          park_period;
+  uint64_t     park_cycle;
+  uint32_t     park_r[CORE_PARK_SIZE][16];
+  flags_t      park_flags[CORE_PARK_SIZE];
+  void         *park_next;
+
+  core_page_t  map[CORE_MAP_SIZE];
+  core_page_t  regions[CORE_REGIONS];
+  int          regions_count;
+
+  void         *trace;
+  bool         event;    // Event register for WFE
+  bool         sleep_on_exit;
+  bool         tick_wake; // SysTick counts with TICKINT set and may wake the core
+  int          ahead_backoff;
+
+#ifdef USE_STATS
+  core_stats_t stats;
+#endif
+} core_ext_t;
+
+// Cores are allocated from contiguous arrays, the state checked by the
+// scheduler on every cycle comes first and fits into one cache line
+typedef struct __attribute__((aligned(CORE_LINE_SIZE)))
+{
+  queue_t      queue;
+
+  // Block run state. The whole run is executed on its first cycle and the
+  // core then stalls for the remaining cycles. Memory writes are logged, so
+  // the run can be rolled back if an interrupt arrives during the stall.
+  int          run_size;
+  int          run_cycle;
+  int          run_busy; // Cycles of the first instruction, never interrupted
+  int          undo_count;
+  bool         logging;
+
+  // A core polling a peripheral register in a loop without side effects is
+  // parked until the register changes. The state before each instruction of
+  // the loop is saved, so the core resumes exactly where it would have been.
+  bool         parked;
+  bool         traced;   // Executes one instruction at a time into the trace
+  uint8_t      ahead_skip; // Run ahead attempts to skip after a short one
+  int          ahead;    // Cycles the core has already executed past the simulation time
+  uint64_t     park_clk;
 
   uint32_t     irqs;
   uint32_t     irq_en;
   uint32_t     ipsr;
   bool         pm;
   bool         sleeping;
+  bool         halted;
+  bool         chained;  // Exception return left the frame for the next one
 
-  uint16_t     opcode;
+  uint32_t     r[16];
+  flags_t      flags;
 
-  uint8_t      ram[CORE_RAM_SIZE];
+  void         *image;
+  void         *decoded;
+  uint8_t      *ram;     // Flash at 0 followed by RAM
+  uint32_t     flash_size;
+  uint32_t     mem_size;
   uint16_t     *flash;
+  core_ext_t   *ext;
   void         *soc;
+  char         *name;
 } core_t;
 
+// Native replacement of a firmware routine, called on entry to the routine.
+// Returns the number of cycles the routine takes or a negative value to run
+// the firmware code instead.
+typedef int (core_hook_t)(core_t *core);
+
 /*- Prototypes --------------------------------------------------------------*/
 void core_setup(void);
+core_t *core_alloc(void);
 void core_init(core_t *core);
-void core_clk(core_t *core);
+bool core_clk(core_t *core);
+int core_run(core_t *core, int cycles);
+int core_run_ahead(core_t *core, int cycles);
+int core_stall(core_t *core);
+void core_skip(core_t *core, int cycles);
+void core_sync(core_t *core);
+void core_wait(core_t *core, int cycles);
 void core_irq_set(core_t *core, int irq);
 void core_irq_clear(core_t *core, int irq);
+void core_park_check(void);
+void core_map(core_t *core, uint32_t addr, uint32_t size, void *mem, bool writable);
+void core_hook(core_t *core, uint32_t addr, core_hook_t *hook);
+
+#ifdef USE_STATS
+void core_stats_print(core_t *core);
+void core_stats_print_total(void);
+#endif
 
 #endif // _CORE_H_
 
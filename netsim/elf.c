@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "elf.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define ELF_HEADER_SIZE     0x34
+#define ELF_SHT_SYMTAB      2
+#define ELF_STT_FUNC        2
+#define ELF_SYM_SIZE        16
+
+/*- Variables ---------------------------------------------------------------*/
+static elf_symbols_t *elf_symbols = NULL;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static uint32_t elf_get(uint8_t *data, uint32_t offset, int size)
+{
+  uint32_t value = 0;
+
+  memcpy(&value, &data[offset], size);
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+static int symbol_compare(const void *a, const void *b)
+{
+  const elf_symbol_t *sa = (const elf_symbol_t *)a;
+  const elf_symbol_t *sb = (const elf_symbol_t *)b;
+
+  if (sa->addr == sb->addr)
+    return 0;
+
+  return (sa->addr < sb->addr) ? -1 : 1;
+}
+
+//-----------------------------------------------------------------------------
+static void elf_read(elf_symbols_t *table, char *path)
+{
+  uint32_t shoff, shentsize, shnum;
+  uint8_t *data;
+  long size;
+  FILE *f;
+  int count;
+
+  f = fopen(path, "rb");
+
+  if (NULL == f)
+    return;
+
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  if (size < ELF_HEADER_SIZE || size >= INT32_MAX)
+    error("ELF file %s is invalid", path);
+
+  data = sim_malloc(size + 1);
+
+  if (size != (long)fread(data, 1, size, f))
+    error("cannot read ELF file %s", path);
+
+  fclose(f);
+
+  if (memcmp(data, "\x7f" "ELF", 4) || 1 != data[4] || 1 != data[5])
+    error("%s is not a 32-bit little-endian ELF file", path);
+
+  shoff = elf_get(data, 0x20, 4);
+  shentsize = elf_get(data, 0x2e, 2);
+  shnum = elf_get(data, 0x30, 2);
+
+  if (shentsize < 0x28 || shoff + (uint64_t)shnum * shentsize > (uint64_t)size)
+    error("ELF file %s is invalid", path);
+
+  for (uint32_t i = 0; i < shnum; i++)
+  {
+    uint32_t sh = shoff + i * shentsize;
+    uint32_t offset, entries, link, strtab, strsize;
+
+    if (ELF_SHT_SYMTAB != elf_get(data, sh + 4, 4))
+      continue;
+
+    offset = elf_get(data, sh + 16, 4);
+    entries = elf_get(data, sh + 20, 4) / ELF_SYM_SIZE;
+    link = elf_get(data, sh + 24, 4);
+
+    if (link >= shnum)
+      error("ELF file %s is invalid", path);
+
+    strtab = elf_get(data, shoff + link * shentsize + 16, 4);
+    strsize = elf_get(data, shoff + link * shentsize + 20, 4);
+
+    if (offset + (uint64_t)entries * ELF_SYM_SIZE > (uint64_t)size ||
+        strtab + (uint64_t)strsize > (uint64_t)size)
+      error("ELF file %s is invalid", path);
+
+    table->symbols = sim_malloc(entries * sizeof(elf_symbol_t));
+
+    for (uint32_t j = 0; j < entries; j++)
+    {
+      uint32_t sym = offset + j * ELF_SYM_SIZE;
+      uint32_t name = elf_get(data, sym, 4);
+      elf_symbol_t *symbol;
+
+      if (ELF_STT_FUNC != (data[sym + 12] & 0xf) || name >= strsize)
+        continue;
+
+      symbol = &table->symbols[table->count++];
+      symbol->addr = elf_get(data, sym + 4, 4) & ~1u;
+      symbol->size = elf_get(data, sym + 8, 4);
+      symbol->name = (char *)&data[strtab + name];
+    }
+
+    break;
+  }
+
+  qsort(table->symbols, table->count, sizeof(elf_symbol_t), symbol_compare);
+
+  count = 0;
+
+  for (int i = 0; i < table->count; i++)
+  {
+    if (0 == count || table->symbols[i].addr != table->symbols[count-1].addr)
+      table->symbols[count++] = table->symbols[i];
+  }
+
+  table->count = count;
+}
+
+//-----------------------------------------------------------------------------
+elf_symbols_t *elf_load(char *path)
+{
+  elf_symbols_t *table;
+  char *elf_path;
+  int len;
+
+  for (table = elf_symbols; table; table = table->next)
+  {
+    if (0 == strcmp(table->path, path))
+      return table;
+  }
+
+  // The ELF file is expected next to the firmware image (build/App.bin and
+  // build/App.elf)
+  len = strlen(path);
+  elf_path = sim_malloc(len + 5);
+  strcpy(elf_path, path);
+
+  if (len > 4 && 0 == strcmp(&elf_path[len - 4], ".bin"))
+    len -= 4;
+
+  strcpy(&elf_path[len], ".elf");
+
+  table = sim_malloc(sizeof(elf_symbols_t));
+  table->path = path;
+  elf_read(table, elf_path);
+  sim_free(elf_path);
+
+  table->next = elf_symbols;
+  elf_symbols = table;
+
+  return table;
+}
+
+//-----------------------------------------------------------------------------
+elf_symbol_t *elf_lookup(elf_symbols_t *table, uint32_t addr)
+{
+  elf_symbol_t *symbol = NULL;
+  int lo = 0;
+  int hi = table->count - 1;
+
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    if (table->symbols[mid].addr <= addr)
+    {
+      symbol = &table->symbols[mid];
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+
+  if (symbol && symbol->size && addr >= (symbol->addr + symbol->size))
+    return NULL;
+
+  return symbol;
+}
+
+//-----------------------------------------------------------------------------
+elf_symbol_t *elf_find(elf_symbols_t *table, const char *name)
+{
+  for (int i = 0; i < table->count; i++)
+  {
+    if (0 == strcmp(table->symbols[i].name, name))
+      return &table->symbols[i];
+  }
+
+  return NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ELF_H_
+#define _ELF_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t     addr;
+  uint32_t     size;
+  char         *name;
+} elf_symbol_t;
+
+// Symbol tables are loaded once per firmware path
+typedef struct elf_symbols_t
+{
+  struct elf_symbols_t *next;
+  char         *path;
+  elf_symbol_t *symbols;
+  int          count;
+} elf_symbols_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+elf_symbols_t *elf_load(char *path);
+elf_symbol_t *elf_lookup(elf_symbols_t *table, uint32_t addr);
+elf_symbol_t *elf_find(elf_symbols_t *table, const char *name);
+
+#endif // _ELF_H_
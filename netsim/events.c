@@ -19,13 +19,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include "main.h"
 #include "utils.h"
 #include "events.h"
 
-/*- Variables ---------------------------------------------------------------*/
-static event_t *events = NULL;
-static event_t *last_event = NULL;
-
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
@@ -33,28 +30,28 @@ void events_add(event_t *event)
 {
   event->time = get_sim_cycle() + event->timeout;
 
-  if (NULL == events)
+  if (NULL == g_part->events)
   {
     event->next = NULL;
-    events = event;
-    last_event = event;
+    g_part->events = event;
+    g_part->last_event = event;
   }
-  else if (event->time >= last_event->time)
+  else if (event->time >= g_part->last_event->time)
   {
     event->next = NULL;
-    last_event->next = event;
-    last_event = event;
+    g_part->last_event->next = event;
+    g_part->last_event = event;
   }
-  else if (event->time <= events->time)
+  else if (event->time <= g_part->events->time)
   {
-    event->next = events;
-    events = event;
+    event->next = g_part->events;
+    g_part->events = event;
   }
   else
   {
     event_t *next, *prev = NULL;
 
-    for (next = events; next->time < event->time; next = next->next)
+    for (next = g_part->events; next->time < event->time; next = next->next)
       prev = next;
 
     event->next = next;
@@ -67,26 +64,30 @@ void events_remove(event_t *event)
 {
   event_t *ev, *prev = NULL;
 
-  for (ev = events; ev && ev != event; ev = ev->next)
+  for (ev = g_part->events; ev && ev != event; ev = ev->next)
     prev = ev;
 
+  // The event may not be planned, its link is stale then
+  if (NULL == ev)
+    return;
+
   if (NULL == prev)
   {
-    events = event->next;
+    g_part->events = event->next;
   }
-  else if (ev)
+  else
   {
     prev->next = event->next;
 
     if (NULL == event->next)
-      last_event = prev;
+      g_part->last_event = prev;
   }
 }
 
 //-----------------------------------------------------------------------------
 bool events_is_planned(event_t *event)
 {
-  for (event_t *ev = events; ev; ev = ev->next)
+  for (event_t *ev = g_part->events; ev; ev = ev->next)
   {
     if (ev == event)
       return true;
@@ -96,27 +97,26 @@ bool events_is_planned(event_t *event)
 }
 
 //-----------------------------------------------------------------------------
-void events_tick(void)
+bool events_tick(void)
 {
   uint64_t cycle = get_sim_cycle();
+  bool fired = false;
 
-  while (events && cycle == events->time)
+  while (g_part->events && cycle == g_part->events->time)
   {
-    event_t *event = events;
-    events = events->next;
+    event_t *event = g_part->events;
+    g_part->events = g_part->events->next;
     event->callback(event);
+    fired = true;
   }
+
+  return fired;
 }
 
 //-----------------------------------------------------------------------------
-uint64_t events_jump(void)
+uint64_t events_next(void)
 {
-  uint64_t delta = 0;
-
-  if (events)
-    delta = events->time - get_sim_cycle();
-
-  return delta;
+  return g_part->events ? g_part->events->time : UINT64_MAX;
 }
 
 
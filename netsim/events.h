@@ -37,8 +37,8 @@ typedef struct event_t
 void events_add(event_t *event);
 void events_remove(event_t *event);
 bool events_is_planned(event_t *event);
-void events_tick(void);
-uint64_t events_jump(void);
+bool events_tick(void);
+uint64_t events_next(void);
 
 #endif // _EVENTS_H_
 
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "jit.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define JIT_POOL_SIZE      (32 * 1024 * 1024)
+#define JIT_FUNCTION_SIZE  (16 * 1024)
+
+#define REG_RBX            3
+
+/*- Variables ---------------------------------------------------------------*/
+static __thread uint8_t *pool = NULL;
+static __thread int pool_used = 0;
+static __thread bool pool_failed = false;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void jit_u8(jit_t *jit, uint8_t value)
+{
+  if (jit->size < JIT_FUNCTION_SIZE)
+    jit->code[jit->size++] = value;
+  else
+    jit->overflow = true;
+}
+
+//-----------------------------------------------------------------------------
+static void jit_u32(jit_t *jit, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    jit_u8(jit, value >> (i * 8));
+}
+
+//-----------------------------------------------------------------------------
+static void jit_u64(jit_t *jit, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    jit_u8(jit, value >> (i * 8));
+}
+
+//-----------------------------------------------------------------------------
+static void jit_rex(jit_t *jit, int reg, int index, int rm)
+{
+  uint8_t rex = 0x40 | ((reg >> 1) & 4) | ((index >> 2) & 2) | ((rm >> 3) & 1);
+
+  if (0x40 != rex)
+    jit_u8(jit, rex);
+}
+
+//-----------------------------------------------------------------------------
+static void jit_rex_w(jit_t *jit, int reg, int rm)
+{
+  jit_u8(jit, 0x48 | ((reg >> 1) & 4) | ((rm >> 3) & 1));
+}
+
+//-----------------------------------------------------------------------------
+static void jit_mem(jit_t *jit, int reg, int disp)
+{
+  // [RBX + disp32]
+  jit_u8(jit, 0x80 | ((reg & 7) << 3) | REG_RBX);
+  jit_u32(jit, disp);
+}
+
+//-----------------------------------------------------------------------------
+static void jit_mem_index(jit_t *jit, int reg, int index, int scale, int disp)
+{
+  int ss = (8 == scale) ? 3 : (4 == scale) ? 2 : (2 == scale) ? 1 : 0;
+
+  // [RBX + index * scale + disp32]
+  jit_u8(jit, 0x84 | ((reg & 7) << 3));
+  jit_u8(jit, (ss << 6) | ((index & 7) << 3) | REG_RBX);
+  jit_u32(jit, disp);
+}
+
+//-----------------------------------------------------------------------------
+static void jit_mem_base(jit_t *jit, int reg, int base, int index, int scale, int disp)
+{
+  int ss = (8 == scale) ? 3 : (4 == scale) ? 2 : (2 == scale) ? 1 : 0;
+
+  // [base + index * scale + disp32]
+  jit_u8(jit, 0x84 | ((reg & 7) << 3));
+  jit_u8(jit, (ss << 6) | ((index & 7) << 3) | (base & 7));
+  jit_u32(jit, disp);
+}
+
+//-----------------------------------------------------------------------------
+static void jit_reg(jit_t *jit, int reg, int rm)
+{
+  jit_u8(jit, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+//-----------------------------------------------------------------------------
+bool jit_begin(jit_t *jit)
+{
+  if (NULL == pool && !pool_failed)
+  {
+    pool = mmap(NULL, JIT_POOL_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == pool)
+    {
+      pool = NULL;
+      pool_failed = true;
+    }
+  }
+
+  if (NULL == pool || (pool_used + JIT_FUNCTION_SIZE) > JIT_POOL_SIZE)
+    return false;
+
+  jit->code = pool + pool_used;
+  jit->size = 0;
+  jit->overflow = false;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void *jit_end(jit_t *jit)
+{
+  if (jit->overflow)
+    return NULL;
+
+  pool_used += (jit->size + 15) & ~15;
+
+  return jit->code;
+}
+
+//-----------------------------------------------------------------------------
+void jit_enter(jit_t *jit)
+{
+  jit_u8(jit, 0x53); // push rbx
+  jit_u8(jit, 0x48); // mov rbx, rdi
+  jit_u8(jit, 0x89);
+  jit_u8(jit, 0xfb);
+}
+
+//-----------------------------------------------------------------------------
+void jit_leave(jit_t *jit, uint32_t value)
+{
+  jit_u8(jit, 0xb8); // mov eax, imm32
+  jit_u32(jit, value);
+  jit_u8(jit, 0x5b); // pop rbx
+  jit_u8(jit, 0xc3); // ret
+}
+
+//-----------------------------------------------------------------------------
+void jit_load(jit_t *jit, int reg, int disp)
+{
+  jit_rex(jit, reg, 0, 0);
+  jit_u8(jit, 0x8b);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_load8(jit_t *jit, int reg, int disp)
+{
+  jit_rex(jit, reg, 0, 0);
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, 0xb6);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_load64(jit_t *jit, int reg, int disp)
+{
+  jit_rex_w(jit, reg, 0);
+  jit_u8(jit, 0x8b);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store64(jit_t *jit, int disp, int reg)
+{
+  jit_rex_w(jit, reg, 0);
+  jit_u8(jit, 0x89);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store(jit_t *jit, int disp, int reg)
+{
+  jit_rex(jit, reg, 0, 0);
+  jit_u8(jit, 0x89);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store_imm(jit_t *jit, int disp, uint32_t imm)
+{
+  jit_u8(jit, 0xc7);
+  jit_mem(jit, 0, disp);
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store_imm64(jit_t *jit, int disp, int32_t imm)
+{
+  jit_rex_w(jit, 0, 0);
+  jit_u8(jit, 0xc7);
+  jit_mem(jit, 0, disp);
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store_imm8(jit_t *jit, int disp, uint8_t imm)
+{
+  jit_u8(jit, 0xc6);
+  jit_mem(jit, 0, disp);
+  jit_u8(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_load_index(jit_t *jit, int type, int reg, int index, int scale, int disp)
+{
+  jit_rex(jit, reg, index, 0);
+
+  if (JIT_WORD != type)
+    jit_u8(jit, 0x0f);
+
+  jit_u8(jit, type);
+  jit_mem_index(jit, reg, index, scale, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store_index(jit_t *jit, int bits, int index, int scale, int disp, int reg)
+{
+  if (16 == bits)
+    jit_u8(jit, 0x66);
+
+  jit_rex(jit, reg, index, 0);
+  jit_u8(jit, (8 == bits) ? 0x88 : 0x89);
+  jit_mem_index(jit, reg, index, scale, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_load_mem(jit_t *jit, int type, int reg, int base, int index, int scale,
+    int disp)
+{
+  jit_rex(jit, reg, index, base);
+
+  if (JIT_WORD != type)
+    jit_u8(jit, 0x0f);
+
+  jit_u8(jit, type);
+  jit_mem_base(jit, reg, base, index, scale, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_store_mem(jit_t *jit, int bits, int base, int index, int scale, int disp,
+    int reg)
+{
+  if (16 == bits)
+    jit_u8(jit, 0x66);
+
+  jit_rex(jit, reg, index, base);
+  jit_u8(jit, (8 == bits) ? 0x88 : 0x89);
+  jit_mem_base(jit, reg, base, index, scale, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_mov(jit_t *jit, int dst, int src)
+{
+  jit_rex(jit, src, 0, dst);
+  jit_u8(jit, 0x89);
+  jit_reg(jit, src, dst);
+}
+
+//-----------------------------------------------------------------------------
+void jit_mov_imm(jit_t *jit, int reg, uint32_t imm)
+{
+  jit_rex(jit, 0, 0, reg);
+  jit_u8(jit, 0xb8 + (reg & 7));
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_movsxd(jit_t *jit, int dst, int src)
+{
+  jit_rex_w(jit, dst, src);
+  jit_u8(jit, 0x63);
+  jit_reg(jit, dst, src);
+}
+
+//-----------------------------------------------------------------------------
+void jit_alu(jit_t *jit, int op, int reg, int disp)
+{
+  jit_rex(jit, reg, 0, 0);
+  jit_u8(jit, op * 8 + 3);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_alu_imm(jit_t *jit, int op, int reg, uint32_t imm)
+{
+  jit_rex(jit, 0, 0, reg);
+  jit_u8(jit, 0x81);
+  jit_reg(jit, op, reg);
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_shift(jit_t *jit, int op, int reg, int imm)
+{
+  jit_rex(jit, 0, 0, reg);
+  jit_u8(jit, 0xc1);
+  jit_reg(jit, op, reg);
+  jit_u8(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_unary(jit_t *jit, int op, int reg)
+{
+  jit_rex(jit, 0, 0, reg);
+  jit_u8(jit, 0xf7);
+  jit_reg(jit, op, reg);
+}
+
+//-----------------------------------------------------------------------------
+void jit_extend(jit_t *jit, int type, int reg)
+{
+  jit_rex(jit, reg, 0, reg);
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, type);
+  jit_reg(jit, reg, reg);
+}
+
+//-----------------------------------------------------------------------------
+void jit_imul(jit_t *jit, int reg, int disp)
+{
+  jit_rex(jit, reg, 0, 0);
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, 0xaf);
+  jit_mem(jit, reg, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_bswap(jit_t *jit, int reg)
+{
+  jit_rex(jit, 0, 0, reg);
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, 0xc8 + (reg & 7));
+}
+
+//-----------------------------------------------------------------------------
+void jit_test(jit_t *jit, int reg)
+{
+  jit_rex(jit, reg, 0, reg);
+  jit_u8(jit, 0x85);
+  jit_reg(jit, reg, reg);
+}
+
+//-----------------------------------------------------------------------------
+void jit_test64(jit_t *jit, int reg)
+{
+  jit_rex_w(jit, reg, reg);
+  jit_u8(jit, 0x85);
+  jit_reg(jit, reg, reg);
+}
+
+//-----------------------------------------------------------------------------
+void jit_test8(jit_t *jit, int reg)
+{
+  jit_u8(jit, 0x84);
+  jit_reg(jit, reg, reg);
+}
+
+//-----------------------------------------------------------------------------
+void jit_setcc(jit_t *jit, int cc, int disp)
+{
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, 0x90 + cc);
+  jit_mem(jit, 0, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_cmp8_imm(jit_t *jit, int disp, uint8_t imm)
+{
+  jit_u8(jit, 0x80);
+  jit_mem(jit, JIT_CMP, disp);
+  jit_u8(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_inc(jit_t *jit, int disp)
+{
+  jit_u8(jit, 0xff);
+  jit_mem(jit, 0, disp);
+}
+
+//-----------------------------------------------------------------------------
+void jit_add_imm(jit_t *jit, int disp, uint32_t imm)
+{
+  jit_u8(jit, 0x81);
+  jit_mem(jit, JIT_ADD, disp);
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+void jit_call(jit_t *jit, void *func, void *arg)
+{
+  jit_u8(jit, 0x48); // mov rdi, rbx
+  jit_u8(jit, 0x89);
+  jit_u8(jit, 0xdf);
+  jit_u8(jit, 0x48); // mov rsi, imm64
+  jit_u8(jit, 0xbe);
+  jit_u64(jit, (uintptr_t)arg);
+  jit_u8(jit, 0x48); // mov rax, imm64
+  jit_u8(jit, 0xb8);
+  jit_u64(jit, (uintptr_t)func);
+  jit_u8(jit, 0xff); // call rax
+  jit_u8(jit, 0xd0);
+}
+
+//-----------------------------------------------------------------------------
+void jit_cmp_abs(jit_t *jit, void *ptr, uint32_t imm)
+{
+  jit_u8(jit, 0x48); // mov rax, imm64
+  jit_u8(jit, 0xb8);
+  jit_u64(jit, (uintptr_t)ptr);
+  jit_u8(jit, 0x81); // cmp dword [rax], imm32
+  jit_u8(jit, 0x38);
+  jit_u32(jit, imm);
+}
+
+//-----------------------------------------------------------------------------
+int jit_jcc(jit_t *jit, int cc)
+{
+  jit_u8(jit, 0x0f);
+  jit_u8(jit, 0x80 + cc);
+  jit_u32(jit, 0);
+
+  return jit->size;
+}
+
+//-----------------------------------------------------------------------------
+void jit_patch(jit_t *jit, int label)
+{
+  uint32_t offset = jit->size - label;
+
+  if (jit->overflow)
+    return;
+
+  memcpy(&jit->code[label - 4], &offset, sizeof(offset));
+}
+
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+// Generated functions take a context pointer as the only argument. It is kept
+// in RBX and memory operands are addressed relative to it, unless an explicit
+// base register is given.
+
+enum // 32-bit registers
+{
+  JIT_EAX = 0,
+  JIT_ECX = 1,
+  JIT_EDX = 2,
+  JIT_R8D = 8,
+  JIT_R9  = 9, // 64-bit, used as a base register
+  JIT_R10 = 10,
+};
+
+enum // ALU operations
+{
+  JIT_ADD = 0,
+  JIT_OR  = 1,
+  JIT_AND = 4,
+  JIT_SUB = 5,
+  JIT_XOR = 6,
+  JIT_CMP = 7,
+};
+
+enum // Shift operations
+{
+  JIT_SHL = 4,
+  JIT_SHR = 5,
+  JIT_SAR = 7,
+};
+
+enum // Unary operations
+{
+  JIT_NOT = 2,
+  JIT_NEG = 3,
+};
+
+enum // Register extensions and indexed loads
+{
+  JIT_WORD   = 0x8b,
+  JIT_ZX_B   = 0xb6,
+  JIT_ZX_H   = 0xb7,
+  JIT_SX_B   = 0xbe,
+  JIT_SX_H   = 0xbf,
+};
+
+enum // Condition codes
+{
+  JIT_O  = 0x0,
+  JIT_B  = 0x2,
+  JIT_AE = 0x3,
+  JIT_E  = 0x4,
+  JIT_NE = 0x5,
+  JIT_S  = 0x8,
+  JIT_NS = 0x9,
+};
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t      *code;
+  int          size;
+  bool         overflow;
+} jit_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+bool jit_begin(jit_t *jit);
+void *jit_end(jit_t *jit);
+
+void jit_enter(jit_t *jit);
+void jit_leave(jit_t *jit, uint32_t value);
+void jit_load(jit_t *jit, int reg, int disp);
+void jit_load8(jit_t *jit, int reg, int disp);
+void jit_load64(jit_t *jit, int reg, int disp);
+void jit_store(jit_t *jit, int disp, int reg);
+void jit_store64(jit_t *jit, int disp, int reg);
+void jit_store_imm(jit_t *jit, int disp, uint32_t imm);
+void jit_store_imm64(jit_t *jit, int disp, int32_t imm);
+void jit_store_imm8(jit_t *jit, int disp, uint8_t imm);
+void jit_load_index(jit_t *jit, int type, int reg, int index, int scale, int disp);
+void jit_store_index(jit_t *jit, int bits, int index, int scale, int disp, int reg);
+void jit_load_mem(jit_t *jit, int type, int reg, int base, int index, int scale, int disp);
+void jit_store_mem(jit_t *jit, int bits, int base, int index, int scale, int disp, int reg);
+void jit_mov(jit_t *jit, int dst, int src);
+void jit_mov_imm(jit_t *jit, int reg, uint32_t imm);
+void jit_movsxd(jit_t *jit, int dst, int src);
+void jit_alu(jit_t *jit, int op, int reg, int disp);
+void jit_alu_imm(jit_t *jit, int op, int reg, uint32_t imm);
+void jit_shift(jit_t *jit, int op, int reg, int imm);
+void jit_unary(jit_t *jit, int op, int reg);
+void jit_extend(jit_t *jit, int type, int reg);
+void jit_imul(jit_t *jit, int reg, int disp);
+void jit_bswap(jit_t *jit, int reg);
+void jit_test(jit_t *jit, int reg);
+void jit_test64(jit_t *jit, int reg);
+void jit_test8(jit_t *jit, int reg);
+void jit_setcc(jit_t *jit, int cc, int disp);
+void jit_cmp8_imm(jit_t *jit, int disp, uint8_t imm);
+void jit_inc(jit_t *jit, int disp);
+void jit_add_imm(jit_t *jit, int disp, uint32_t imm);
+void jit_call(jit_t *jit, void *func, void *arg);
+void jit_cmp_abs(jit_t *jit, void *ptr, uint32_t imm);
+int jit_jcc(jit_t *jit, int cc);
+void jit_patch(jit_t *jit, int label);
+
+#endif // _JIT_H_
+
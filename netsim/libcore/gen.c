@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include "../core.c"
+
+/*- Variables ---------------------------------------------------------------*/
+sim_t g_sim;
+__thread part_t *g_part = &g_sim.part;
+
+static bool present[HASH_TABLE_SIZE];
+static uint16_t flash[2];
+static image_t image;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+uint8_t soc_read_b(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+uint16_t soc_read_h(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t soc_read_w(soc_t *soc, uint32_t addr)
+{
+  (void)soc;
+  (void)addr;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_b(soc_t *soc, uint32_t addr, uint8_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_h(soc_t *soc, uint32_t addr, uint16_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void soc_write_w(soc_t *soc, uint32_t addr, uint32_t data)
+{
+  (void)soc;
+  (void)addr;
+  (void)data;
+}
+
+//-----------------------------------------------------------------------------
+void trace_flush(trace_t *trace)
+{
+  (void)trace;
+}
+
+//-----------------------------------------------------------------------------
+static void load_firmware(char *name)
+{
+  uint8_t buf[CORE_FLASH_SIZE];
+  FILE *f;
+  int size;
+
+  f = fopen(name, "rb");
+
+  if (NULL == f)
+    error("could not open firmware file '%s'", name);
+
+  size = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  // Any halfword may be an instruction, including the second halfword
+  // of a 32-bit instruction and literal pool entries.
+  for (int i = 0; i < size - 1; i += 2)
+    present[buf[i] | (buf[i + 1] << 8)] = true;
+}
+
+//-----------------------------------------------------------------------------
+static bool gen_handler(FILE *f, int opcode)
+{
+  const instr_t *instr = hash[opcode];
+  core_t core;
+  decoded_t d;
+
+  if (&undefined == instr || FMT_32BIT == instr->format)
+    return false;
+
+  flash[0] = opcode;
+  core.flash = flash;
+  core.image = &image;
+  core_decode(&core, 0, &d);
+
+  fprintf(f, "//-----------------------------------------------------------------------------\n");
+  fprintf(f, "static void __attribute__((flatten)) i_0x%04x(core_t *core, decoded_t *d)\n", opcode);
+  fprintf(f, "{\n");
+  fprintf(f, "  static const decoded_t s = { NULL, 0x%08x, %d, %d, %d, %d };\n",
+      d.imm, d.r1, d.r2, d.r3, d.exec);
+  fprintf(f, "  (void)d;\n");
+  fprintf(f, "  instructions[%d].handler(core, (decoded_t *)&s);\n", (int)(instr - instructions));
+  fprintf(f, "}\n\n");
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  static bool generated[HASH_TABLE_SIZE];
+  FILE *f;
+  int count = 0;
+
+  if (argc < 2)
+  {
+    printf("Usage: %s <output> [firmware...]\n", argv[0]);
+    return 0;
+  }
+
+  core_setup();
+
+  for (int i = 2; i < argc; i++)
+    load_firmware(argv[i]);
+
+  if (2 == argc)
+    memset(present, 1, sizeof(present));
+
+  f = fopen(argv[1], "w");
+
+  if (NULL == f)
+    error("could not open output file '%s'", argv[1]);
+
+  fprintf(f, "// This file is generated by libcore/gen.c, do not edit.\n\n");
+
+  for (int i = 0; i < HASH_TABLE_SIZE; i++)
+  {
+    if (present[i] && gen_handler(f, i))
+    {
+      generated[i] = true;
+      count++;
+    }
+  }
+
+  fprintf(f, "static handler_t * const specialized[HASH_TABLE_SIZE] =\n");
+  fprintf(f, "{\n");
+
+  for (int i = 0; i < HASH_TABLE_SIZE; i++)
+  {
+    if (generated[i])
+      fprintf(f, "  [0x%04x] = i_0x%04x,\n", i, i);
+  }
+
+  fprintf(f, "};\n");
+  fclose(f);
+
+  printf("Generated %d handlers\n", count);
+
+  return 0;
+}
@@ -23,18 +23,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include "trx.h"
 #include "soc.h"
 #include "main.h"
+#include "events.h"
+#include "medium.h"
 #include "utils.h"
 #include "config.h"
+#include "profile.h"
+#include "trace.h"
+
+/*- Definitions -------------------------------------------------------------*/
+// Nodes can not affect each other faster than this, so they are advanced
+// by this much between the synchronizations in the threaded mode
+#define SIM_WINDOW     TRX_LOOKAHEAD
+#define SIM_SEED_STEP  0x9e3779b9
 
 /*- Variables ---------------------------------------------------------------*/
 sim_t g_sim;
+__thread part_t *g_part = &g_sim.part;
+
+static pthread_barrier_t sim_barrier;
+static volatile sig_atomic_t sim_interrupted = 0;
+static bool sim_stopping = false;
 
 /*- Implementations ---------------------------------------------------------*/
 
@@ -58,19 +75,49 @@ static void measure_time(void)
 
     diff_msec = (tv_stop.tv_sec - tv_start.tv_sec)*1000;
     diff_msec += (tv_stop.tv_usec - tv_start.tv_usec)/1000;
+    diff_msec = max(diff_msec, 1u);
 
-    printf("%"PRId64" cycles in %u ms => %"PRId64" cycles/sec\n", g_sim.cycle,
-        diff_msec, (g_sim.cycle*1000)/diff_msec);
+    printf("%"PRId64" cycles in %u ms => %"PRId64" cycles/sec\n", g_part->cycle,
+        diff_msec, (g_part->cycle*1000)/diff_msec);
   }
 }
 
+#ifdef USE_STATS
+//-----------------------------------------------------------------------------
+static void print_stats(void)
+{
+  queue_foreach(trx_t, trx, &g_sim.trxs)
+    core_stats_print(((soc_t *)trx->soc)->core);
+
+  core_stats_print_total();
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static void sim_finish(void)
+{
+  measure_time();
+  profile_finish();
+  trace_finish();
+#ifdef USE_STATS
+  print_stats();
+#endif
+}
+
 #ifdef __linux__
 //-----------------------------------------------------------------------------
 static void sig_handler(int signum)
 {
   if (SIGINT == signum)
   {
-    measure_time();
+    // Threads are stopped at the end of the current window
+    if (g_sim.threads)
+    {
+      sim_interrupted = 1;
+      return;
+    }
+
+    sim_finish();
     exit(0);
   }
 }
@@ -87,22 +134,284 @@ static void register_sigaction(void)
 }
 #endif
 
+//-----------------------------------------------------------------------------
+void part_init(part_t *part)
+{
+  queue_init(&part->active);
+  queue_init(&part->sleeping);
+  queue_init(&part->messages);
+}
+
 //-----------------------------------------------------------------------------
 static void sim_init(void)
 {
   g_sim.seed = 123456;
   g_sim.time = 1000000;
   g_sim.scale = 1.0f;
+  g_sim.flash_size = CORE_FLASH_SIZE;
+  g_sim.ram_size = CORE_RAM_SIZE;
+  g_sim.call_cycles = 4;
+  g_sim.call_byte_cycles = 0.25f;
 
   g_sim.node_uid = 0;
   g_sim.noise_uid = 0;
   g_sim.sniffer_uid = 0;
 
-  queue_init(&g_sim.active);
-  queue_init(&g_sim.sleeping);
+  part_init(&g_sim.part);
   queue_init(&g_sim.trxs);
   queue_init(&g_sim.noises);
   queue_init(&g_sim.sniffers);
+  queue_init(&g_sim.profiles);
+  queue_init(&g_sim.traces);
+}
+
+//-----------------------------------------------------------------------------
+static void sim_run_single(void)
+{
+  core_t *core = (core_t *)g_part->active.next;
+  uint64_t next = min(events_next(), g_part->end - 1);
+
+  // Nothing else may happen before the next event, let the only active
+  // node run ahead. Debug output and traces must have the correct time.
+  if (DEBUG_CORE || core->traced || next <= g_part->cycle)
+    return;
+
+  g_part->cycle += core_run(core, min(next - g_part->cycle, (uint64_t)INT_MAX));
+}
+
+//-----------------------------------------------------------------------------
+static bool sim_clk(core_t *core)
+{
+  bool stalled = core_clk(core);
+  uint64_t next = g_part->cycle;
+  int cycles = 0;
+
+  // Other nodes may only interrupt a node through its transceiver while it
+  // is listening, the rest of the interrupts come from its own events. A
+  // node that is not listening runs ahead on its own until the next event
+  // or the next peripheral access, which keeps the result the same as if
+  // all nodes were clocked together. This is only tried when the core has
+  // just started a new block run or executed a single instruction.
+  if ((stalled && 1 != core->run_cycle) || core->ahead || core->parked ||
+      DEBUG_CORE || core->traced)
+    return stalled;
+
+  if (core->ahead_skip)
+  {
+    core->ahead_skip--;
+    return stalled;
+  }
+
+  if (!((soc_t *)core->soc)->trx.rx)
+    next = min(events_next(), g_part->end - 1);
+
+  if (next > g_part->cycle)
+    cycles = min(next - g_part->cycle - 1, (uint64_t)INT_MAX);
+
+  if (core_run_ahead(core, cycles))
+    return true;
+
+  return stalled;
+}
+
+//-----------------------------------------------------------------------------
+static void sim_skip_stalled(void)
+{
+  uint64_t next = events_next();
+  uint64_t skip;
+
+  if (next <= g_part->cycle)
+    return;
+
+  skip = next - g_part->cycle;
+
+  if (skip > g_part->end - g_part->cycle)
+    skip = g_part->end - g_part->cycle;
+
+  queue_foreach(core_t, core, &g_part->active)
+  {
+    uint64_t stall = core_stall(core);
+
+    if (stall < skip)
+      skip = stall;
+
+    if (0 == skip)
+      return;
+  }
+
+  queue_foreach(core_t, core, &g_part->active)
+    core_skip(core, skip);
+
+  g_part->cycle += skip;
+}
+
+//-----------------------------------------------------------------------------
+static void sim_run(void)
+{
+  bool stalled = false;
+
+  while (g_part->cycle < g_part->end)
+  {
+    if (queue_is_empty(&g_part->active))
+      g_part->cycle = min(events_next(), g_part->end - 1);
+    else if (queue_is_single(&g_part->active))
+      sim_run_single();
+    else if (stalled)
+      sim_skip_stalled();
+
+    stalled = true;
+
+    queue_foreach(core_t, core, &g_part->active)
+      stalled &= sim_clk(core);
+
+    if (events_tick())
+      soc_park_check();
+
+    g_part->cycle++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void sim_flush_log(void)
+{
+  static part_t **parts = NULL;
+  static int *offsets = NULL;
+  int count = 0;
+
+  if (NULL == parts)
+  {
+    parts = (part_t **)sim_malloc(g_sim.node_uid * sizeof(part_t *));
+    offsets = (int *)sim_malloc(g_sim.node_uid * sizeof(int));
+  }
+
+  queue_foreach(trx_t, trx, &g_sim.trxs)
+  {
+    part_t *part = SOC(trx)->part;
+
+    if (part->log_used)
+    {
+      offsets[count] = 0;
+      parts[count++] = part;
+    }
+  }
+
+  // Lines are printed in the order of time and then node
+  while (count)
+  {
+    uint64_t cycle, first = UINT64_MAX;
+    int index = 0;
+    char *line;
+
+    for (int i = 0; i < count; i++)
+    {
+      memcpy(&cycle, &parts[i]->log[offsets[i]], sizeof(uint64_t));
+
+      if (cycle < first)
+      {
+        first = cycle;
+        index = i;
+      }
+    }
+
+    line = &parts[index]->log[offsets[index] + sizeof(uint64_t)];
+    fputs(line, stdout);
+    offsets[index] += sizeof(uint64_t) + strlen(line) + 1;
+
+    if (offsets[index] == parts[index]->log_used)
+    {
+      parts[index]->log_used = 0;
+      parts[index] = parts[--count];
+      offsets[index] = offsets[count];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void *sim_thread(void *arg)
+{
+  int thread = (intptr_t)arg;
+
+  for (uint64_t cycle = 0; cycle < g_sim.time; cycle += SIM_WINDOW)
+  {
+    uint64_t end = min(cycle + SIM_WINDOW, g_sim.time);
+
+    pthread_barrier_wait(&sim_barrier);
+
+    queue_foreach(trx_t, trx, &g_sim.trxs)
+    {
+      part_t *part = SOC(trx)->part;
+
+      if (part->thread != thread)
+        continue;
+
+      g_part = part;
+      g_part->end = end;
+      sim_run();
+    }
+
+    g_part = &g_sim.part;
+
+    if (0 == thread)
+      sim_stopping = sim_interrupted;
+
+    pthread_barrier_wait(&sim_barrier);
+
+    // Other threads wait for the next window while the medium is synchronized
+    if (0 == thread)
+    {
+      g_part->cycle = end;
+      medium_sync();
+      sim_flush_log();
+    }
+
+    if (sim_stopping)
+      break;
+  }
+
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+static void sim_run_threads(void)
+{
+  pthread_t *threads = (pthread_t *)sim_malloc(g_sim.threads * sizeof(pthread_t));
+#ifdef __linux__
+  sigset_t sigint, old;
+#endif
+
+  queue_foreach(trx_t, trx, &g_sim.trxs)
+  {
+    part_t *part = SOC(trx)->part;
+
+    rand_init(&part->rand, g_sim.seed + trx->uid * SIM_SEED_STEP);
+  }
+
+  pthread_barrier_init(&sim_barrier, NULL, g_sim.threads);
+
+#ifdef __linux__
+  // Workers inherit the blocked SIGINT, so it is always delivered to this thread
+  sigemptyset(&sigint);
+  sigaddset(&sigint, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &sigint, &old);
+#endif
+
+  for (int i = 1; i < g_sim.threads; i++)
+  {
+    if (0 != pthread_create(&threads[i], NULL, sim_thread, (void *)(intptr_t)i))
+      error("cannot create a simulation thread");
+  }
+
+#ifdef __linux__
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+#endif
+
+  sim_thread((void *)0);
+
+  for (int i = 1; i < g_sim.threads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_barrier_destroy(&sim_barrier);
+  sim_free(threads);
 }
 
 //-----------------------------------------------------------------------------
@@ -116,7 +425,7 @@ int main(int argc, char *argv[])
 
   config_read(argv[1]);
 
-  rand_init(g_sim.seed);
+  rand_init(&g_sim.part.rand, g_sim.seed);
 
 #ifdef __linux__
   register_sigaction();
@@ -124,20 +433,17 @@ int main(int argc, char *argv[])
 
   measure_time();
 
-  for (g_sim.cycle = 0; g_sim.cycle < g_sim.time; )
+  if (g_sim.threads)
   {
-    if (queue_is_empty(&g_sim.active))
-      g_sim.cycle += events_jump();
-
-    queue_foreach(soc_t, soc, &g_sim.active)
-      soc_clk(soc);
-
-    events_tick();
-    g_sim.cycle++;
+    sim_run_threads();
+  }
+  else
+  {
+    g_part->end = g_sim.time;
+    sim_run();
   }
 
-  measure_time();
+  sim_finish();
 
   return 0;
 }
-
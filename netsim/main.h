@@ -22,28 +22,61 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "utils.h"
+#include "events.h"
 #include "config.h"
 
 /*- Types -------------------------------------------------------------------*/
+// Nodes clocked together on a common time base. Normally the whole network
+// is one part. In the threaded mode each node is a part of its own and parts
+// only see each other through the medium, which is synchronized between
+// fixed windows of time.
+typedef struct
+{
+  uint64_t     cycle;
+  uint64_t     end;
+  int          thread;
+
+  queue_t      active;
+  queue_t      sleeping;
+  event_t      *events;
+  event_t      *last_event;
+  void         *parked;
+  rand_t       rand;
+
+  queue_t      messages; // Medium messages produced during the window
+  char         *log;     // Output produced during the window
+  int          log_size;
+  int          log_used;
+} part_t;
+
 typedef struct
 {
   uint32_t     seed;
   uint64_t     time;
   float        scale;
+  uint32_t     flash_size;
+  uint32_t     ram_size;
+  int          call_cycles;
+  float        call_byte_cycles;
   int          node_uid;
   int          noise_uid;
   int          sniffer_uid;
-  uint64_t     cycle;
+  int          threads;
 
-  queue_t      active;
-  queue_t      sleeping;
+  part_t       part;
   queue_t      trxs;
   queue_t      noises;
   queue_t      sniffers;
+  queue_t      profiles;
+  queue_t      traces;
 } sim_t;
 
 /*- Variables ---------------------------------------------------------------*/
 extern sim_t g_sim;
+extern __thread part_t *g_part;
+
+/*- Prototypes --------------------------------------------------------------*/
+void part_init(part_t *part);
 
 #endif // _MAIN_H_
 
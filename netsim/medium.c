@@ -21,8 +21,11 @@
 #include <stdlib.h>
 #include "medium.h"
 #include "trx.h"
+#include "soc.h"
 #include "main.h"
 #include "noise.h"
+#include "events.h"
+#include "sniffer.h"
 #include "utils.h"
 
 /*- Definitions -------------------------------------------------------------*/
@@ -30,6 +33,38 @@
 #define NOISE_FLOOR     (-120.0) // dBm
 #define ADD_PATH_LOSS   6.0 // dB
 
+/*- Types -------------------------------------------------------------------*/
+// Three strongest carriers seen by a receiver
+typedef struct
+{
+  trx_t        *trxs[3];
+  float        carriers[3];
+  float        dists[3];
+  float        noise;
+} medium_carriers_t;
+
+// Change in the medium delivered to a receiver in the threaded mode
+typedef struct
+{
+  event_t      event;
+  trx_t        *trx;
+  medium_tx_t  *tx;
+  bool         start;
+} medium_event_t;
+
+typedef struct
+{
+  queue_t      queue;
+  medium_tx_t  *tx;
+  uint64_t     time;
+  bool         start;
+  bool         normal;
+  int          seq;
+} medium_msg_t;
+
+/*- Variables ---------------------------------------------------------------*/
+static queue_t medium_txs = { &medium_txs, &medium_txs };
+
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
@@ -61,79 +96,110 @@ static inline float lqi_limit(float lqi)
     return lqi;
 }
 
+//-----------------------------------------------------------------------------
+static void medium_add_carrier(medium_carriers_t *c, trx_t *rx_trx, trx_t *tx_trx,
+    float tx_power, float lambda)
+{
+  float power, dist, loss, add_loss;
+
+  dist = distance(rx_trx->x, rx_trx->y, tx_trx->x, tx_trx->y);
+  loss = 20.0*log10f(4.0*M_PI * dist / lambda);
+  add_loss = rx_trx->loss_trx ? rx_trx->loss_trx[tx_trx->uid] : 0.0;
+  power = tx_power - loss - add_loss - ADD_PATH_LOSS;
+
+  // Simulates random power loss due to fading and multipath propagation (-10 - 0 dB)
+  power += -10.0 * randf_next();
+
+  if (power < rx_trx->reg.rx_sensitivity)
+    return;
+
+  if (power > c->carriers[0])
+  {
+    c->trxs[2] = c->trxs[1];
+    c->trxs[1] = c->trxs[0];
+    c->trxs[0] = tx_trx;
+
+    c->dists[2] = c->dists[1];
+    c->dists[1] = c->dists[0];
+    c->dists[0] = dist;
+
+    c->carriers[2] = c->carriers[1];
+    c->carriers[1] = c->carriers[0];
+    c->carriers[0] = power;
+  }
+  else if (power > c->carriers[1])
+  {
+    c->trxs[2] = c->trxs[1];
+    c->trxs[1] = tx_trx;
+
+    c->dists[2] = c->dists[1];
+    c->dists[1] = dist;
+
+    c->carriers[2] = c->carriers[1];
+    c->carriers[1] = power;
+  }
+  else if (power > c->carriers[2])
+  {
+    c->trxs[2] = tx_trx;
+    c->dists[2] = dist;
+    c->carriers[2] = power;
+  }
+
+  c->noise = padd(c->noise, power);
+}
+
+//-----------------------------------------------------------------------------
+static inline bool medium_tx_visible(medium_tx_t *tx)
+{
+  uint64_t cycle = g_part->cycle;
+
+  return (tx->start + TRX_LOOKAHEAD) <= cycle && (cycle - TRX_LOOKAHEAD) < tx->end;
+}
+
 //-----------------------------------------------------------------------------
 void medium_update_trx(trx_t *rx_trx)
 {
   float noise, power, lambda, dist, loss, add_loss, freq;
   float lqi_carrier, lqi_noise, lqi_power;
-  float carriers[3], dists[3];
-  trx_t *trxs[3];
+  medium_carriers_t c;
 
-  noise = NOISE_FLOOR;
+  c.noise = NOISE_FLOOR;
   freq = rx_trx->reg.channel * MHz;
   lambda = C / freq;
 
   for (int i = 0; i < 3; i++)
   {
-    trxs[i] = NULL;
-    carriers[i] = NOISE_FLOOR;
-    dists[i] = 10000;
+    c.trxs[i] = NULL;
+    c.carriers[i] = NOISE_FLOOR;
+    c.dists[i] = 10000;
   }
 
-  queue_foreach(trx_t, tx_trx, &g_sim.trxs)
+  if (g_sim.threads)
   {
-    if (tx_trx == rx_trx || !tx_trx->tx || tx_trx->reg.channel != rx_trx->reg.channel)
-      continue;
-
-    dist = distance(rx_trx->x, rx_trx->y, tx_trx->x, tx_trx->y);
-    loss = 20.0*log10f(4.0*M_PI * dist / lambda);
-    add_loss = rx_trx->loss_trx ? rx_trx->loss_trx[tx_trx->uid] : 0.0;
-    power = tx_trx->reg.tx_power - loss - add_loss - ADD_PATH_LOSS;
-
-    // Simulates random power loss due to fading and multipath propagation (-10 - 0 dB)
-    power += -10.0 * randf_next();
-
-    if (power < rx_trx->reg.rx_sensitivity)
-      continue;
-
-    if (power > carriers[0])
+    queue_foreach(medium_tx_t, tx, &medium_txs)
     {
-      trxs[2] = trxs[1];
-      trxs[1] = trxs[0];
-      trxs[0] = tx_trx;
-
-      dists[2] = dists[1];
-      dists[1] = dists[0];
-      dists[0] = dist;
+      if (tx->trx == rx_trx || tx->channel != rx_trx->reg.channel || !medium_tx_visible(tx))
+        continue;
 
-      carriers[2] = carriers[1];
-      carriers[1] = carriers[0];
-      carriers[0] = power;
+      medium_add_carrier(&c, rx_trx, tx->trx, tx->tx_power, lambda);
     }
-    else if (power > carriers[1])
+  }
+  else
+  {
+    queue_foreach(trx_t, tx_trx, &g_sim.trxs)
     {
-      trxs[2] = trxs[1];
-      trxs[1] = tx_trx;
-
-      dists[2] = dists[1];
-      dists[1] = dist;
+      if (tx_trx == rx_trx || !tx_trx->tx || tx_trx->reg.channel != rx_trx->reg.channel)
+        continue;
 
-      carriers[2] = carriers[1];
-      carriers[1] = power;
-    }
-    else if (power > carriers[2])
-    {
-      trxs[2] = tx_trx;
-      dists[2] = dist;
-      carriers[2] = power;
+      medium_add_carrier(&c, rx_trx, tx_trx, tx_trx->reg.tx_power, lambda);
     }
-
-    noise = padd(noise, power);
   }
 
+  noise = c.noise;
+
   queue_foreach(noise_t, tx_noise, &g_sim.noises)
   {
-    if (!tx_noise->active || freq < tx_noise->freq_a || freq > tx_noise->freq_b)
+    if (!noise_is_active(tx_noise) || freq < tx_noise->freq_a || freq > tx_noise->freq_b)
       continue;
 
     dist = distance(rx_trx->x, rx_trx->y, tx_noise->x, tx_noise->y);
@@ -144,54 +210,115 @@ void medium_update_trx(trx_t *rx_trx)
   }
 
   rx_trx->rx_rssi = noise;
-  rx_trx->rx_carrier = carriers[0];
-  rx_trx->rx_dist = dists[0];
+  rx_trx->rx_carrier = c.carriers[0];
+  rx_trx->rx_dist = c.dists[0];
 
-  if (rx_trx->rx_trx != trxs[0])
+  if (rx_trx->rx_trx != c.trxs[0])
     rx_trx->rx_crc_ok = false;
 
   if (!rx_trx->rx_trx_lock)
-    rx_trx->rx_trx = trxs[0];
+    rx_trx->rx_trx = c.trxs[0];
 
-  if (NULL == trxs[0])
+  if (NULL == c.trxs[0])
     return;
 
   // LQI drop due to correlated noise
-  if (NULL != trxs[1])
-    lqi_carrier = (carriers[0] - carriers[1]) / 3.0;
+  if (NULL != c.trxs[1])
+    lqi_carrier = (c.carriers[0] - c.carriers[1]) / 3.0;
   else
     lqi_carrier = 1.0;
 
   lqi_carrier = lqi_limit(lqi_carrier);
 
   // LQI drop due to uncorrelated noise
-  noise = psub(noise, carriers[0]);
-  lqi_noise = (carriers[0] - noise) / 3.0;
+  noise = psub(noise, c.carriers[0]);
+  lqi_noise = (c.carriers[0] - noise) / 3.0;
   lqi_noise = lqi_limit(lqi_noise);
 
   // LQI drop due to RX power level
-  lqi_power = 1.0 - expf(-0.2*(carriers[0] - NOISE_FLOOR));
+  lqi_power = 1.0 - expf(-0.2*(c.carriers[0] - NOISE_FLOOR));
   lqi_power = lqi_limit(lqi_power);
 
   rx_trx->rx_lqi *= lqi_carrier * lqi_noise * lqi_power;
 }
 
+//-----------------------------------------------------------------------------
+static void medium_sniff(trx_t *trx, uint32_t channel, float tx_power, uint8_t *data)
+{
+  float power, lambda, dist, loss, add_loss, freq;
+
+  freq = channel * MHz;
+  lambda = C / freq;
+
+  queue_foreach(sniffer_t, sniffer, &g_sim.sniffers)
+  {
+    if (freq < sniffer->freq_a || freq > sniffer->freq_b)
+      continue;
+
+    dist = distance(sniffer->x, sniffer->y, trx->x, trx->y);
+    loss = 20.0*log10f(4.0*M_PI * dist / lambda);
+    add_loss = sniffer->loss_trx ? sniffer->loss_trx[trx->uid] : 0.0;
+    power = tx_power - loss - add_loss;
+
+    if (power < sniffer->sensitivity)
+      continue;
+
+    sniffer_write_frame(sniffer, data, power);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void medium_message(medium_tx_t *tx, bool start, bool normal)
+{
+  medium_msg_t *msg = (medium_msg_t *)sim_malloc(sizeof(medium_msg_t));
+
+  msg->tx = tx;
+  msg->time = g_part->cycle;
+  msg->start = start;
+  msg->normal = normal;
+  queue_add(&g_part->messages, msg);
+}
+
 //-----------------------------------------------------------------------------
 void medium_tx_start(trx_t *trx)
 {
+  if (g_sim.threads)
+  {
+    medium_tx_t *tx = (medium_tx_t *)sim_malloc(sizeof(medium_tx_t));
+
+    tx->trx = trx;
+    tx->start = g_part->cycle;
+    tx->end = UINT64_MAX;
+    tx->tx_power = trx->reg.tx_power;
+    tx->channel = trx->reg.channel;
+    tx->sfd = trx->reg.sfd;
+    memcpy(tx->data, trx->tx_data, sizeof(tx->data));
+
+    trx->tx_medium = tx;
+    medium_message(tx, true, false);
+    return;
+  }
+
   queue_foreach(trx_t, rx_trx, &g_sim.trxs)
   {
     if (rx_trx->rx)
       medium_update_trx(rx_trx);
 
     if (rx_trx->rx && rx_trx->rx_trx == trx && rx_trx->reg.sfd == trx->reg.sfd)
-      trx_rx_start(rx_trx);
+      trx_rx_start(rx_trx, trx->tx_data);
   }
 }
 
 //-----------------------------------------------------------------------------
 void medium_tx_end(trx_t *trx, bool normal)
 {
+  if (g_sim.threads)
+  {
+    medium_message(trx->tx_medium, false, normal);
+    trx->tx_medium = NULL;
+    return;
+  }
+
   queue_foreach(trx_t, rx_trx, &g_sim.trxs)
   {
     if (rx_trx->rx && rx_trx->rx_trx == trx && rx_trx->rx_trx_lock)
@@ -199,27 +326,136 @@ void medium_tx_end(trx_t *trx, bool normal)
   }
 
   if (normal)
+    medium_sniff(trx, trx->reg.channel, trx->reg.tx_power, trx->tx_data);
+}
+
+//-----------------------------------------------------------------------------
+static void medium_event_cb(event_t *event)
+{
+  medium_event_t *ev = (medium_event_t *)event->data;
+  trx_t *trx = ev->trx;
+  medium_tx_t *tx = ev->tx;
+
+  if (ev->start)
+  {
+    if (trx->rx)
+      medium_update_trx(trx);
+
+    if (trx->rx && trx->rx_trx == tx->trx && trx->reg.sfd == tx->sfd)
+      trx_rx_start(trx, tx->data);
+  }
+  else
+  {
+    if (trx->rx && trx->rx_trx == tx->trx && trx->rx_trx_lock)
+      trx_rx_end(trx, tx->normal);
+  }
+
+  sim_free(ev);
+}
+
+//-----------------------------------------------------------------------------
+static void medium_deliver(trx_t *trx, medium_tx_t *tx, bool start, uint64_t time)
+{
+  medium_event_t *ev = (medium_event_t *)sim_malloc(sizeof(medium_event_t));
+  part_t *part = g_part;
+
+  ev->trx = trx;
+  ev->tx = tx;
+  ev->start = start;
+
+  g_part = SOC(trx)->part;
+  ev->event.timeout = time - g_part->cycle;
+  ev->event.callback = medium_event_cb;
+  ev->event.data = (void *)ev;
+  events_add(&ev->event);
+  g_part = part;
+}
+
+//-----------------------------------------------------------------------------
+static int medium_msg_compare(const void *a, const void *b)
+{
+  const medium_msg_t *msg_a = *(const medium_msg_t **)a;
+  const medium_msg_t *msg_b = *(const medium_msg_t **)b;
+
+  if (msg_a->time != msg_b->time)
+    return (msg_a->time < msg_b->time) ? -1 : 1;
+
+  return msg_a->seq - msg_b->seq;
+}
+
+//-----------------------------------------------------------------------------
+void medium_sync(void)
+{
+  static medium_msg_t **msgs = NULL;
+  static int msgs_size = 0;
+  uint64_t cycle = g_part->cycle;
+  int count = 0;
+
+  // Messages are put in the order of time and then node, so the result does
+  // not depend on how the nodes are split between the threads
+  queue_foreach(trx_t, trx, &g_sim.trxs)
   {
-    float power, lambda, dist, loss, add_loss, freq;
+    part_t *part = SOC(trx)->part;
+
+    queue_foreach(medium_msg_t, msg, &part->messages)
+    {
+      if (count == msgs_size)
+      {
+        msgs_size = msgs_size * 2 + 64;
+        msgs = realloc(msgs, msgs_size * sizeof(medium_msg_t *));
 
-    freq = trx->reg.channel * MHz;
-    lambda = C / freq;
+        if (NULL == msgs)
+          error("out of memory");
+      }
+
+      msg->seq = count;
+      msgs[count++] = msg;
+    }
+
+    queue_init(&part->messages);
+  }
 
-    queue_foreach(sniffer_t, sniffer, &g_sim.sniffers)
+  qsort(msgs, count, sizeof(medium_msg_t *), medium_msg_compare);
+
+  for (int i = 0; i < count; i++)
+  {
+    medium_msg_t *msg = msgs[i];
+    medium_tx_t *tx = msg->tx;
+
+    if (msg->start)
     {
-      if (freq < sniffer->freq_a || freq > sniffer->freq_b)
-        continue;
+      queue_add(&medium_txs, tx);
+    }
+    else
+    {
+      tx->end = msg->time;
+      tx->normal = msg->normal;
+
+      if (tx->normal)
+      {
+        g_part->cycle = msg->time;
+        medium_sniff(tx->trx, tx->channel, tx->tx_power, tx->data);
+      }
+    }
 
-      dist = distance(sniffer->x, sniffer->y, trx->x, trx->y);
-      loss = 20.0*log10f(4.0*M_PI * dist / lambda);
-      add_loss = sniffer->loss_trx ? sniffer->loss_trx[trx->uid] : 0.0;
-      power = trx->reg.tx_power - loss - add_loss;
+    queue_foreach(trx_t, rx_trx, &g_sim.trxs)
+    {
+      if (rx_trx != tx->trx)
+        medium_deliver(rx_trx, tx, msg->start, msg->time + TRX_LOOKAHEAD);
+    }
 
-      if (power < sniffer->sensitivity)
-        continue;
+    sim_free(msg);
+  }
+
+  g_part->cycle = cycle;
 
-      sniffer_write_frame(sniffer, trx->tx_data, power);
+  // Frames that ended before the last delivery are not needed any more
+  queue_foreach(medium_tx_t, tx, &medium_txs)
+  {
+    if (UINT64_MAX != tx->end && (tx->end + TRX_LOOKAHEAD) < cycle)
+    {
+      queue_remove(&medium_txs, tx);
+      sim_free(tx);
     }
   }
 }
-
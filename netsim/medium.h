@@ -21,11 +21,29 @@
 /*- Includes ----------------------------------------------------------------*/
 #include "trx.h"
 
+/*- Types -------------------------------------------------------------------*/
+// Frame transmitted in the threaded mode. Other nodes only see it after
+// TRX_LOOKAHEAD, so everything they need is copied when it starts.
+typedef struct medium_tx_t
+{
+  queue_t      queue;
+
+  trx_t        *trx;
+  uint64_t     start;
+  uint64_t     end;
+  bool         normal;
+  float        tx_power;
+  uint32_t     channel;
+  uint32_t     sfd;
+  uint8_t      data[128];
+} medium_tx_t;
+
 /*- Prototypes --------------------------------------------------------------*/
 void medium_update_trx(trx_t *rx_trx);
 
 void medium_tx_start(trx_t *trx);
 void medium_tx_end(trx_t *trx, bool normal);
+void medium_sync(void);
 
 #endif // _MEDIUM_H_
 
@@ -0,0 +1,644 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "soc.h"
+#include "core.h"
+#include "utils.h"
+#include "elf.h"
+#include "native.h"
+
+/*- Types -------------------------------------------------------------------*/
+// Routines follow the AAPCS, arguments and results are passed in r0-r3.
+// Cycle counts are typical for the libgcc and newlib-nano code on Cortex-M0.
+// Anything the native code can not reproduce exactly (division by zero,
+// NaN results, out of range conversions, buffers outside of the memory) is
+// left to the firmware code.
+typedef struct
+{
+  const char   *name;
+  core_hook_t  *hook;
+} native_routine_t;
+
+enum
+{
+  NATIVE_EQ,
+  NATIVE_LT,
+  NATIVE_LE,
+  NATIVE_GE,
+  NATIVE_GT,
+};
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static uint8_t *native_mem(core_t *core, uint32_t addr, uint32_t size, bool write)
+{
+  uint32_t start = write ? core->flash_size : 0;
+
+  if (addr < start || addr > core->mem_size || size > core->mem_size - addr)
+    return NULL;
+
+  return &core->ram[addr];
+}
+
+//-----------------------------------------------------------------------------
+static float native_get_f(core_t *core, int r)
+{
+  float value;
+
+  memcpy(&value, &core->r[r], sizeof(value));
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+static double native_get_d(core_t *core, int r)
+{
+  uint64_t bits = ((uint64_t)core->r[r + 1] << 32) | core->r[r];
+  double value;
+
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+static void native_set_f(core_t *core, float value)
+{
+  memcpy(&core->r[0], &value, sizeof(value));
+}
+
+//-----------------------------------------------------------------------------
+static void native_set_d(core_t *core, double value)
+{
+  uint64_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+
+  core->r[0] = bits;
+  core->r[1] = bits >> 32;
+}
+
+//-----------------------------------------------------------------------------
+static int native_uidiv(core_t *core)
+{
+  if (0 == core->r[1])
+    return -1;
+
+  core->r[0] = core->r[0] / core->r[1];
+
+  return 45;
+}
+
+//-----------------------------------------------------------------------------
+static int native_uidivmod(core_t *core)
+{
+  uint32_t n = core->r[0];
+  uint32_t d = core->r[1];
+
+  if (0 == d)
+    return -1;
+
+  core->r[0] = n / d;
+  core->r[1] = n % d;
+
+  return 50;
+}
+
+//-----------------------------------------------------------------------------
+static int native_idiv(core_t *core)
+{
+  int32_t n = core->r[0];
+  int32_t d = core->r[1];
+
+  if (0 == d || (INT32_MIN == n && -1 == d))
+    return -1;
+
+  core->r[0] = n / d;
+
+  return 50;
+}
+
+//-----------------------------------------------------------------------------
+static int native_idivmod(core_t *core)
+{
+  int32_t n = core->r[0];
+  int32_t d = core->r[1];
+
+  if (0 == d || (INT32_MIN == n && -1 == d))
+    return -1;
+
+  core->r[0] = n / d;
+  core->r[1] = n % d;
+
+  return 55;
+}
+
+//-----------------------------------------------------------------------------
+static int native_uldivmod(core_t *core)
+{
+  uint64_t n = ((uint64_t)core->r[1] << 32) | core->r[0];
+  uint64_t d = ((uint64_t)core->r[3] << 32) | core->r[2];
+  uint64_t q, r;
+
+  if (0 == d)
+    return -1;
+
+  q = n / d;
+  r = n % d;
+
+  core->r[0] = q;
+  core->r[1] = q >> 32;
+  core->r[2] = r;
+  core->r[3] = r >> 32;
+
+  return 250;
+}
+
+//-----------------------------------------------------------------------------
+static int native_ldivmod(core_t *core)
+{
+  int64_t n = (int64_t)(((uint64_t)core->r[1] << 32) | core->r[0]);
+  int64_t d = (int64_t)(((uint64_t)core->r[3] << 32) | core->r[2]);
+  uint64_t q, r;
+
+  if (0 == d || (INT64_MIN == n && -1 == d))
+    return -1;
+
+  q = n / d;
+  r = n % d;
+
+  core->r[0] = q;
+  core->r[1] = q >> 32;
+  core->r[2] = r;
+  core->r[3] = r >> 32;
+
+  return 280;
+}
+
+//-----------------------------------------------------------------------------
+static int native_memmove(core_t *core)
+{
+  uint32_t size = core->r[2];
+  uint8_t *dst = native_mem(core, core->r[0], size, true);
+  uint8_t *src = native_mem(core, core->r[1], size, false);
+
+  if (NULL == dst || NULL == src)
+    return -1;
+
+  memmove(dst, src, size);
+
+  return 12 + size * 4;
+}
+
+//-----------------------------------------------------------------------------
+static int native_memset(core_t *core)
+{
+  uint32_t size = core->r[2];
+  uint8_t *dst = native_mem(core, core->r[0], size, true);
+
+  if (NULL == dst)
+    return -1;
+
+  memset(dst, core->r[1] & 0xff, size);
+
+  return 12 + size * 3;
+}
+
+//-----------------------------------------------------------------------------
+static int native_aeabi_memset(core_t *core)
+{
+  uint32_t size = core->r[1];
+  uint8_t *dst = native_mem(core, core->r[0], size, true);
+
+  if (NULL == dst)
+    return -1;
+
+  memset(dst, core->r[2] & 0xff, size);
+
+  return 12 + size * 3;
+}
+
+//-----------------------------------------------------------------------------
+static int native_aeabi_memclr(core_t *core)
+{
+  uint32_t size = core->r[1];
+  uint8_t *dst = native_mem(core, core->r[0], size, true);
+
+  if (NULL == dst)
+    return -1;
+
+  memset(dst, 0, size);
+
+  return 12 + size * 3;
+}
+
+//-----------------------------------------------------------------------------
+static int native_memcmp(core_t *core)
+{
+  uint32_t size = core->r[2];
+  uint8_t *a = native_mem(core, core->r[0], size, false);
+  uint8_t *b = native_mem(core, core->r[1], size, false);
+  uint32_t i;
+
+  if (NULL == a || NULL == b)
+    return -1;
+
+  for (i = 0; i < size && a[i] == b[i]; i++);
+
+  core->r[0] = (i < size) ? (uint32_t)(a[i] - b[i]) : 0;
+
+  return 12 + i * 6;
+}
+
+//-----------------------------------------------------------------------------
+static int native_strlen(core_t *core)
+{
+  uint32_t addr = core->r[0];
+  uint8_t *str;
+  uint8_t *end;
+
+  if (addr >= core->mem_size)
+    return -1;
+
+  str = &core->ram[addr];
+  end = memchr(str, 0, core->mem_size - addr);
+
+  if (NULL == end)
+    return -1;
+
+  core->r[0] = end - str;
+
+  return 10 + (end - str) * 4;
+}
+
+//-----------------------------------------------------------------------------
+static int native_fop(core_t *core, float res, int cycles)
+{
+  if (isnan(res))
+    return -1;
+
+  native_set_f(core, res);
+
+  return cycles;
+}
+
+//-----------------------------------------------------------------------------
+static int native_dop(core_t *core, double res, int cycles)
+{
+  if (isnan(res))
+    return -1;
+
+  native_set_d(core, res);
+
+  return cycles;
+}
+
+//-----------------------------------------------------------------------------
+static int native_fadd(core_t *core)
+{
+  return native_fop(core, native_get_f(core, 0) + native_get_f(core, 1), 70);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fsub(core_t *core)
+{
+  return native_fop(core, native_get_f(core, 0) - native_get_f(core, 1), 70);
+}
+
+//-----------------------------------------------------------------------------
+static int native_frsub(core_t *core)
+{
+  return native_fop(core, native_get_f(core, 1) - native_get_f(core, 0), 70);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fmul(core_t *core)
+{
+  return native_fop(core, native_get_f(core, 0) * native_get_f(core, 1), 60);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fdiv(core_t *core)
+{
+  return native_fop(core, native_get_f(core, 0) / native_get_f(core, 1), 110);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dadd(core_t *core)
+{
+  return native_dop(core, native_get_d(core, 0) + native_get_d(core, 2), 110);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dsub(core_t *core)
+{
+  return native_dop(core, native_get_d(core, 0) - native_get_d(core, 2), 110);
+}
+
+//-----------------------------------------------------------------------------
+static int native_drsub(core_t *core)
+{
+  return native_dop(core, native_get_d(core, 2) - native_get_d(core, 0), 110);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dmul(core_t *core)
+{
+  return native_dop(core, native_get_d(core, 0) * native_get_d(core, 2), 140);
+}
+
+//-----------------------------------------------------------------------------
+static int native_ddiv(core_t *core)
+{
+  return native_dop(core, native_get_d(core, 0) / native_get_d(core, 2), 500);
+}
+
+//-----------------------------------------------------------------------------
+static int native_compare(core_t *core, double a, double b, int op, int cycles)
+{
+  bool res = false;
+
+  // Comparisons with NaN are false, like the library ones
+  switch (op)
+  {
+    case NATIVE_EQ: res = (a == b); break;
+    case NATIVE_LT: res = (a < b); break;
+    case NATIVE_LE: res = (a <= b); break;
+    case NATIVE_GE: res = (a >= b); break;
+    case NATIVE_GT: res = (a > b); break;
+  }
+
+  core->r[0] = res;
+
+  return cycles;
+}
+
+//-----------------------------------------------------------------------------
+static int native_fcmpeq(core_t *core)
+{
+  return native_compare(core, native_get_f(core, 0), native_get_f(core, 1), NATIVE_EQ, 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fcmplt(core_t *core)
+{
+  return native_compare(core, native_get_f(core, 0), native_get_f(core, 1), NATIVE_LT, 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fcmple(core_t *core)
+{
+  return native_compare(core, native_get_f(core, 0), native_get_f(core, 1), NATIVE_LE, 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fcmpge(core_t *core)
+{
+  return native_compare(core, native_get_f(core, 0), native_get_f(core, 1), NATIVE_GE, 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_fcmpgt(core_t *core)
+{
+  return native_compare(core, native_get_f(core, 0), native_get_f(core, 1), NATIVE_GT, 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dcmpeq(core_t *core)
+{
+  return native_compare(core, native_get_d(core, 0), native_get_d(core, 2), NATIVE_EQ, 45);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dcmplt(core_t *core)
+{
+  return native_compare(core, native_get_d(core, 0), native_get_d(core, 2), NATIVE_LT, 45);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dcmple(core_t *core)
+{
+  return native_compare(core, native_get_d(core, 0), native_get_d(core, 2), NATIVE_LE, 45);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dcmpge(core_t *core)
+{
+  return native_compare(core, native_get_d(core, 0), native_get_d(core, 2), NATIVE_GE, 45);
+}
+
+//-----------------------------------------------------------------------------
+static int native_dcmpgt(core_t *core)
+{
+  return native_compare(core, native_get_d(core, 0), native_get_d(core, 2), NATIVE_GT, 45);
+}
+
+//-----------------------------------------------------------------------------
+static int native_i2f(core_t *core)
+{
+  native_set_f(core, (float)(int32_t)core->r[0]);
+  return 40;
+}
+
+//-----------------------------------------------------------------------------
+static int native_ui2f(core_t *core)
+{
+  native_set_f(core, (float)core->r[0]);
+  return 40;
+}
+
+//-----------------------------------------------------------------------------
+static int native_i2d(core_t *core)
+{
+  native_set_d(core, (double)(int32_t)core->r[0]);
+  return 40;
+}
+
+//-----------------------------------------------------------------------------
+static int native_ui2d(core_t *core)
+{
+  native_set_d(core, (double)core->r[0]);
+  return 40;
+}
+
+//-----------------------------------------------------------------------------
+static int native_to_int(core_t *core, double value, int cycles)
+{
+  if (!(value > -2147483649.0 && value < 2147483648.0))
+    return -1;
+
+  core->r[0] = (int32_t)value;
+
+  return cycles;
+}
+
+//-----------------------------------------------------------------------------
+static int native_to_uint(core_t *core, double value, int cycles)
+{
+  if (!(value > -1.0 && value < 4294967296.0))
+    return -1;
+
+  core->r[0] = (uint32_t)value;
+
+  return cycles;
+}
+
+//-----------------------------------------------------------------------------
+static int native_f2iz(core_t *core)
+{
+  return native_to_int(core, native_get_f(core, 0), 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_f2uiz(core_t *core)
+{
+  return native_to_uint(core, native_get_f(core, 0), 30);
+}
+
+//-----------------------------------------------------------------------------
+static int native_d2iz(core_t *core)
+{
+  return native_to_int(core, native_get_d(core, 0), 40);
+}
+
+//-----------------------------------------------------------------------------
+static int native_d2uiz(core_t *core)
+{
+  return native_to_uint(core, native_get_d(core, 0), 40);
+}
+
+//-----------------------------------------------------------------------------
+static int native_f2d(core_t *core)
+{
+  return native_dop(core, native_get_f(core, 0), 35);
+}
+
+//-----------------------------------------------------------------------------
+static int native_d2f(core_t *core)
+{
+  return native_fop(core, (float)native_get_d(core, 0), 55);
+}
+
+//-----------------------------------------------------------------------------
+static const native_routine_t native_routines[] =
+{
+  { "__aeabi_uidiv",     native_uidiv },
+  { "__udivsi3",         native_uidiv },
+  { "__aeabi_uidivmod",  native_uidivmod },
+  { "__aeabi_idiv",      native_idiv },
+  { "__divsi3",          native_idiv },
+  { "__aeabi_idivmod",   native_idivmod },
+  { "__aeabi_uldivmod",  native_uldivmod },
+  { "__aeabi_ldivmod",   native_ldivmod },
+
+  { "memcpy",            native_memmove },
+  { "memmove",           native_memmove },
+  { "__aeabi_memcpy",    native_memmove },
+  { "__aeabi_memcpy4",   native_memmove },
+  { "__aeabi_memcpy8",   native_memmove },
+  { "__aeabi_memmove",   native_memmove },
+  { "__aeabi_memmove4",  native_memmove },
+  { "__aeabi_memmove8",  native_memmove },
+  { "memset",            native_memset },
+  { "__aeabi_memset",    native_aeabi_memset },
+  { "__aeabi_memset4",   native_aeabi_memset },
+  { "__aeabi_memset8",   native_aeabi_memset },
+  { "__aeabi_memclr",    native_aeabi_memclr },
+  { "__aeabi_memclr4",   native_aeabi_memclr },
+  { "__aeabi_memclr8",   native_aeabi_memclr },
+  { "memcmp",            native_memcmp },
+  { "strlen",            native_strlen },
+
+  { "__aeabi_fadd",      native_fadd },
+  { "__aeabi_fsub",      native_fsub },
+  { "__aeabi_frsub",     native_frsub },
+  { "__aeabi_fmul",      native_fmul },
+  { "__aeabi_fdiv",      native_fdiv },
+  { "__aeabi_fcmpeq",    native_fcmpeq },
+  { "__aeabi_fcmplt",    native_fcmplt },
+  { "__aeabi_fcmple",    native_fcmple },
+  { "__aeabi_fcmpge",    native_fcmpge },
+  { "__aeabi_fcmpgt",    native_fcmpgt },
+  { "__aeabi_i2f",       native_i2f },
+  { "__aeabi_ui2f",      native_ui2f },
+  { "__aeabi_f2iz",      native_f2iz },
+  { "__aeabi_f2uiz",     native_f2uiz },
+  { "__aeabi_f2d",       native_f2d },
+
+  { "__aeabi_dadd",      native_dadd },
+  { "__aeabi_dsub",      native_dsub },
+  { "__aeabi_drsub",     native_drsub },
+  { "__aeabi_dmul",      native_dmul },
+  { "__aeabi_ddiv",      native_ddiv },
+  { "__aeabi_dcmpeq",    native_dcmpeq },
+  { "__aeabi_dcmplt",    native_dcmplt },
+  { "__aeabi_dcmple",    native_dcmple },
+  { "__aeabi_dcmpge",    native_dcmpge },
+  { "__aeabi_dcmpgt",    native_dcmpgt },
+  { "__aeabi_i2d",       native_i2d },
+  { "__aeabi_ui2d",      native_ui2d },
+  { "__aeabi_d2iz",      native_d2iz },
+  { "__aeabi_d2uiz",     native_d2uiz },
+  { "__aeabi_d2f",       native_d2f },
+};
+
+//-----------------------------------------------------------------------------
+bool native_bind(soc_t *soc, const char *name, uint32_t addr)
+{
+  addr &= ~1u;
+
+  if (addr >= soc->core->flash_size)
+    error("%s: native routine '%s' at 0x%08x is outside of the flash", soc->name, name, addr);
+
+  for (int i = 0; i < (int)(sizeof(native_routines) / sizeof(native_routines[0])); i++)
+  {
+    if (0 == strcmp(native_routines[i].name, name))
+    {
+      core_hook(soc->core, addr, native_routines[i].hook);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+int native_bind_elf(soc_t *soc)
+{
+  elf_symbols_t *symbols = elf_load(soc->path);
+  int count = 0;
+
+  for (int i = 0; i < (int)(sizeof(native_routines) / sizeof(native_routines[0])); i++)
+  {
+    elf_symbol_t *symbol = elf_find(symbols, native_routines[i].name);
+
+    if (symbol && symbol->addr < soc->core->flash_size)
+    {
+      core_hook(soc->core, symbol->addr, native_routines[i].hook);
+      count++;
+    }
+  }
+
+  return count;
+}
@@ -38,6 +38,11 @@ void noise_init(noise_t *noise)
     NOISE_DBG(noise, "warning: noise source is always off");
     noise->active = false;
   }
+  else if (g_sim.threads)
+  {
+    // Each thread follows the schedule on its own, see noise_is_active()
+    noise->active = true;
+  }
   else
   {
     noise->active = false;
@@ -77,3 +82,15 @@ static void noise_change_state(noise_t *noise)
   events_add(&noise->event);
 }
 
+//-----------------------------------------------------------------------------
+bool noise_is_active(noise_t *noise)
+{
+  uint64_t cycle = get_sim_cycle();
+
+  if (0 == g_sim.threads || 0 == noise->on || 0 == noise->off)
+    return noise->active;
+
+  // Same as the events would do, the state changes after the cycle is over
+  return 0 == cycle || ((cycle - 1) % (noise->on + noise->off)) < (uint64_t)noise->on;
+}
+
@@ -44,6 +44,7 @@ typedef struct noise_t
 
 /*- Prototypes --------------------------------------------------------------*/
 void noise_init(noise_t *noise);
+bool noise_is_active(noise_t *noise);
 
 #endif // _NOISE_H_
 
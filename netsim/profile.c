@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "soc.h"
+#include "core.h"
+#include "main.h"
+#include "utils.h"
+#include "events.h"
+#include "elf.h"
+#include "profile.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SP     13
+#define LR     14
+#define PC     15
+
+#define PROFILE_DEPTH       64
+#define PROFILE_SCAN        1024
+#define PROFILE_LINE_SIZE   8192
+
+#define PROFILE_SLEEP       0xffffffff
+#define PROFILE_EXCEPTION   0xffffff00
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t     addr;
+  uint64_t     self;
+  uint64_t     total;
+} profile_entry_t;
+
+typedef struct
+{
+  profile_entry_t *entries;
+  int          count;
+  int          size;
+} profile_table_t;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Checks that addr is a return address of a call to func. Calls through
+// a register can not be checked and are always accepted.
+static bool profile_is_call(core_t *core, uint32_t addr, uint32_t func)
+{
+  uint16_t *code = (uint16_t *)core->ram;
+  uint32_t hw1, hw2, s, i1, i2, offset;
+
+  if (0 == (addr & 1) || addr < 5 || addr > core->flash_size)
+    return false;
+
+  addr &= ~1u;
+  hw2 = code[(addr - 2) >> 1];
+
+  if (0x4780 == (hw2 & 0xff87))
+    return true;
+
+  hw1 = code[(addr - 4) >> 1];
+
+  if (0xf000 != (hw1 & 0xf800) || 0xd000 != (hw2 & 0xd000))
+    return false;
+
+  s = (hw1 >> 10) & 1;
+  i1 = ~(((hw2 >> 13) & 1) ^ s) & 1;
+  i2 = ~(((hw2 >> 11) & 1) ^ s) & 1;
+
+  offset = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3ff) << 12) | ((hw2 & 0x7ff) << 1);
+  offset |= s ? 0xff000000 : 0x00000000;
+
+  return (addr + offset) == func;
+}
+
+//-----------------------------------------------------------------------------
+static bool profile_is_exc_return(uint32_t value)
+{
+  return 0xfffffff0 == (value & 0xfffffff0);
+}
+
+//-----------------------------------------------------------------------------
+// Builds the call stack starting from the innermost function. Return
+// addresses are taken from LR and from the stack, each one must be a call
+// of the previous function, so stale values left on the stack are skipped.
+static int profile_unwind(profile_t *profile, core_t *core, uint32_t *stack)
+{
+  elf_symbols_t *table = (elf_symbols_t *)profile->symbols;
+  uint16_t *code = (uint16_t *)core->ram;
+  uint32_t *ram = (uint32_t *)core->ram;
+  uint32_t pc = core->r[PC] & ~1u;
+  uint32_t sp = core->r[SP];
+  uint32_t top = min(ram[0], core->mem_size);
+  elf_symbol_t *symbol, *caller;
+  int depth = 0;
+
+  // WFI or WFE right before the PC
+  if (core->sleeping && pc >= 2 && pc <= core->mem_size &&
+      0xbf20 == (code[(pc - 2) >> 1] & 0xffef))
+    stack[depth++] = PROFILE_SLEEP;
+
+  symbol = elf_lookup(table, pc);
+
+  if (NULL == symbol)
+  {
+    stack[depth++] = pc;
+    return depth;
+  }
+
+  stack[depth++] = symbol->addr;
+
+  if (core->ipsr && profile_is_exc_return(core->r[LR]))
+    top = 0;
+
+  if (profile_is_call(core, core->r[LR], symbol->addr) &&
+      (caller = elf_lookup(table, core->r[LR] & ~1u)))
+  {
+    stack[depth++] = caller->addr;
+    symbol = caller;
+  }
+
+  if ((sp & 3) || sp < core->flash_size)
+    top = 0;
+
+  for (int i = 0; sp < top && i < PROFILE_SCAN && depth < (PROFILE_DEPTH - 1); sp += 4, i++)
+  {
+    uint32_t value = ram[sp >> 2];
+
+    if (core->ipsr && profile_is_exc_return(value))
+      break;
+
+    if (profile_is_call(core, value, symbol->addr) &&
+        (caller = elf_lookup(table, value & ~1u)))
+    {
+      stack[depth++] = caller->addr;
+      symbol = caller;
+    }
+  }
+
+  if (core->ipsr)
+    stack[depth++] = PROFILE_EXCEPTION | core->ipsr;
+
+  return depth;
+}
+
+//-----------------------------------------------------------------------------
+static void profile_record(profile_t *profile, uint32_t *stack, int depth)
+{
+  profile_frame_t *frame = &profile->root;
+
+  for (int i = depth - 1; i >= 0; i--)
+  {
+    profile_frame_t *child;
+
+    for (child = frame->child; child && child->addr != stack[i]; child = child->next);
+
+    if (NULL == child)
+    {
+      child = (profile_frame_t *)sim_malloc(sizeof(profile_frame_t));
+      child->addr = stack[i];
+      child->next = frame->child;
+      frame->child = child;
+    }
+
+    frame = child;
+  }
+
+  frame->samples++;
+  profile->samples++;
+}
+
+//-----------------------------------------------------------------------------
+static void profile_sample(event_t *event)
+{
+  profile_t *profile = (profile_t *)event->data;
+  core_t *core = ((soc_t *)profile->soc)->core;
+  uint32_t stack[PROFILE_DEPTH];
+  int depth;
+
+  core_sync(core);
+  depth = profile_unwind(profile, core, stack);
+  profile_record(profile, stack, depth);
+
+  events_add(&profile->event);
+}
+
+//-----------------------------------------------------------------------------
+void profile_init(profile_t *profile)
+{
+  profile->file = fopen(profile->path, "w");
+
+  if (NULL == profile->file)
+    error("cannot create profile output file %s", profile->path);
+
+  profile->symbols = elf_load(((soc_t *)profile->soc)->path);
+
+  profile->event.timeout = profile->period;
+  profile->event.callback = profile_sample;
+  profile->event.data = profile;
+  events_add(&profile->event);
+}
+
+//-----------------------------------------------------------------------------
+static const char *profile_name(profile_t *profile, uint32_t addr, char *buf)
+{
+  elf_symbol_t *symbol;
+
+  if (PROFILE_SLEEP == addr)
+    return "[sleep]";
+
+  if (PROFILE_EXCEPTION == (addr & 0xffffff00))
+  {
+    sprintf(buf, "[exception %d]", addr & 0xff);
+    return buf;
+  }
+
+  symbol = elf_lookup((elf_symbols_t *)profile->symbols, addr);
+
+  if (symbol && symbol->addr == addr)
+    return symbol->name;
+
+  sprintf(buf, "0x%08x", addr);
+  return buf;
+}
+
+//-----------------------------------------------------------------------------
+static void profile_write(profile_t *profile, profile_frame_t *frame, char *line, int len)
+{
+  for (profile_frame_t *child = frame->child; child; child = child->next)
+  {
+    char buf[32];
+    int size;
+
+    size = snprintf(&line[len], PROFILE_LINE_SIZE - len, "%s%s", len ? ";" : "",
+        profile_name(profile, child->addr, buf));
+    size = min(size, PROFILE_LINE_SIZE - len - 1);
+
+    if (child->samples)
+      fprintf(profile->file, "%s %"PRIu64"\n", line, child->samples);
+
+    profile_write(profile, child, line, len + size);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static profile_entry_t *profile_entry(profile_table_t *table, uint32_t addr)
+{
+  profile_entry_t *entry;
+
+  for (int i = 0; i < table->count; i++)
+  {
+    if (table->entries[i].addr == addr)
+      return &table->entries[i];
+  }
+
+  if (table->count == table->size)
+  {
+    profile_entry_t *entries;
+
+    table->size = table->size ? table->size * 2 : 64;
+    entries = (profile_entry_t *)sim_malloc(table->size * sizeof(profile_entry_t));
+
+    if (table->entries)
+    {
+      memcpy(entries, table->entries, table->count * sizeof(profile_entry_t));
+      sim_free(table->entries);
+    }
+
+    table->entries = entries;
+  }
+
+  entry = &table->entries[table->count++];
+  entry->addr = addr;
+
+  return entry;
+}
+
+//-----------------------------------------------------------------------------
+static uint64_t profile_collect(profile_table_t *table, profile_frame_t *frame,
+    uint32_t *path, int depth)
+{
+  profile_entry_t *entry = profile_entry(table, frame->addr);
+  uint64_t total = frame->samples;
+  bool recursive = false;
+
+  path[depth] = frame->addr;
+
+  for (profile_frame_t *child = frame->child; child; child = child->next)
+    total += profile_collect(table, child, path, depth + 1);
+
+  for (int i = 0; i < depth; i++)
+    recursive |= (path[i] == frame->addr);
+
+  entry->self += frame->samples;
+
+  if (!recursive)
+    entry->total += total;
+
+  return total;
+}
+
+//-----------------------------------------------------------------------------
+static int entry_compare(const void *a, const void *b)
+{
+  const profile_entry_t *ea = (const profile_entry_t *)a;
+  const profile_entry_t *eb = (const profile_entry_t *)b;
+
+  if (ea->self != eb->self)
+    return (ea->self > eb->self) ? -1 : 1;
+
+  if (ea->total != eb->total)
+    return (ea->total > eb->total) ? -1 : 1;
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+static void profile_print(profile_t *profile)
+{
+  profile_table_t table = { NULL, 0, 0 };
+  uint32_t path[PROFILE_DEPTH];
+  double scale = profile->samples ? 100.0 / profile->samples : 0.0;
+
+  for (profile_frame_t *child = profile->root.child; child; child = child->next)
+    profile_collect(&table, child, path, 0);
+
+  qsort(table.entries, table.count, sizeof(profile_entry_t), entry_compare);
+
+  printf("Profile of %s: %"PRIu64" samples, one every %ld cycles\n",
+      ((soc_t *)profile->soc)->name, profile->samples, profile->period);
+  printf("%14s %7s %14s %7s  %s\n", "self", "%", "total", "%", "function");
+
+  for (int i = 0; i < table.count; i++)
+  {
+    profile_entry_t *entry = &table.entries[i];
+    char buf[32];
+
+    printf("%14"PRIu64" %6.2f%% %14"PRIu64" %6.2f%%  %s\n",
+        entry->self * profile->period, entry->self * scale,
+        entry->total * profile->period, entry->total * scale,
+        profile_name(profile, entry->addr, buf));
+  }
+
+  sim_free(table.entries);
+}
+
+//-----------------------------------------------------------------------------
+void profile_finish(void)
+{
+  static char line[PROFILE_LINE_SIZE];
+
+  queue_foreach(profile_t, profile, &g_sim.profiles)
+  {
+    profile_write(profile, &profile->root, line, 0);
+    fclose(profile->file);
+
+    profile_print(profile);
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+#include "events.h"
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct profile_frame_t
+{
+  struct profile_frame_t *child;
+  struct profile_frame_t *next;
+  uint32_t     addr;
+  uint64_t     samples;
+} profile_frame_t;
+
+typedef struct profile_t
+{
+  queue_t      queue;
+
+  void         *soc;
+  long         period;
+  char         *path;
+  FILE         *file;
+
+  void         *symbols;
+  event_t      event;
+  uint64_t     samples;
+  profile_frame_t root;
+} profile_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+void profile_init(profile_t *profile);
+void profile_finish(void);
+
+#endif // _PROFILE_H_
+
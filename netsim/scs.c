@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include "io_ops.h"
+#include "soc.h"
+#include "core.h"
+#include "utils.h"
+#include "events.h"
+#include "scs.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SCS_CPUID_VALUE        0x410cc601 // Cortex-M0+ r0p1
+#define SCS_SYST_CALIB_VALUE   0xc0000000 // No reference clock, inexact 10 ms
+#define SCS_SYST_MASK          0x00ffffff
+#define SCS_SYS_TICK_MASK      (1u << CORE_IRQ_SYS_TICK)
+
+/*- Prototypes --------------------------------------------------------------*/
+static void scs_syst_event_cb(event_t *event);
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void scs_init(scs_t *scs)
+{
+  scs->reload = 0;
+  scs->reg.syst_csr = SCS_SYST_CSR_CLKSOURCE;
+  scs->reg.syst_rvr = 0;
+  scs->reg.syst_cvr = 0;
+  scs->reg.scr = 0;
+  scs->reg.shpr2 = 0;
+  scs->reg.shpr3 = 0;
+
+  scs->event.callback = scs_syst_event_cb;
+  scs->event.data = (void *)scs;
+}
+
+//-----------------------------------------------------------------------------
+static uint32_t scs_syst_value(scs_t *scs)
+{
+  uint64_t cycle = get_sim_cycle();
+
+  if (0 == (scs->reg.syst_csr & SCS_SYST_CSR_ENABLE))
+    return scs->reg.syst_cvr;
+
+  // The counter is not polled, its value follows from the time of the next
+  // wrap to zero
+  if (!events_is_planned(&scs->event) || cycle < scs->reload)
+    return 0;
+
+  return scs->event.time - cycle;
+}
+
+//-----------------------------------------------------------------------------
+static void scs_syst_start(scs_t *scs, uint32_t value)
+{
+  uint64_t cycle = get_sim_cycle();
+
+  if (events_is_planned(&scs->event))
+    events_remove(&scs->event);
+
+  if (value)
+  {
+    scs->reload = cycle;
+    scs->event.timeout = value;
+    events_add(&scs->event);
+  }
+  else if (scs->reg.syst_rvr)
+  {
+    // Zero is reloaded on the next cycle without counting as a wrap
+    scs->reload = cycle + 1;
+    scs->event.timeout = scs->reg.syst_rvr + 1;
+    events_add(&scs->event);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void scs_syst_stop(scs_t *scs)
+{
+  scs->reg.syst_cvr = scs_syst_value(scs);
+
+  if (events_is_planned(&scs->event))
+    events_remove(&scs->event);
+}
+
+//-----------------------------------------------------------------------------
+static uint32_t scs_read_w(scs_t *scs, uint32_t addr)
+{
+  core_t *core = SOC(scs)->core;
+  uint32_t value;
+
+  switch (addr)
+  {
+    case SCS_SYST_CSR:
+    {
+      value = scs->reg.syst_csr;
+      scs->reg.syst_csr &= ~SCS_SYST_CSR_COUNTFLAG;
+      return value;
+    }
+
+    case SCS_SYST_RVR:
+      return scs->reg.syst_rvr;
+
+    case SCS_SYST_CVR:
+      return scs_syst_value(scs);
+
+    case SCS_SYST_CALIB:
+      return SCS_SYST_CALIB_VALUE;
+
+    case SCS_NVIC_ISER:
+    case SCS_NVIC_ICER:
+      return core->irq_en & ~SCS_SYS_TICK_MASK;
+
+    case SCS_CPUID:
+      return SCS_CPUID_VALUE;
+
+    case SCS_ICSR:
+      return core->ipsr | ((core->irqs & SCS_SYS_TICK_MASK) ? SCS_ICSR_PENDSTSET : 0);
+
+    case SCS_SCR:
+      return scs->reg.scr;
+
+    case SCS_SHPR2:
+      return scs->reg.shpr2;
+
+    case SCS_SHPR3:
+      return scs->reg.shpr3;
+  }
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+static void scs_write_w(scs_t *scs, uint32_t addr, uint32_t data)
+{
+  core_t *core = SOC(scs)->core;
+
+  switch (addr)
+  {
+    case SCS_SYST_CSR:
+    {
+      uint32_t enable = data & SCS_SYST_CSR_ENABLE;
+
+      if (enable && 0 == (scs->reg.syst_csr & SCS_SYST_CSR_ENABLE))
+        scs_syst_start(scs, scs->reg.syst_cvr);
+      else if (!enable && (scs->reg.syst_csr & SCS_SYST_CSR_ENABLE))
+        scs_syst_stop(scs);
+
+      scs->reg.syst_csr = (scs->reg.syst_csr & SCS_SYST_CSR_COUNTFLAG) |
+          (data & (SCS_SYST_CSR_ENABLE | SCS_SYST_CSR_TICKINT)) | SCS_SYST_CSR_CLKSOURCE;
+
+      // The exception itself is always enabled, TICKINT only controls
+      // whether a wrap makes it pending
+      core->ext->tick_wake = enable && (data & SCS_SYST_CSR_TICKINT);
+    } break;
+
+    case SCS_SYST_RVR:
+    {
+      scs->reg.syst_rvr = data & SCS_SYST_MASK;
+
+      // A counter stopped at zero by an empty reload value starts again
+      if ((scs->reg.syst_csr & SCS_SYST_CSR_ENABLE) && !events_is_planned(&scs->event))
+        scs_syst_start(scs, 0);
+    } break;
+
+    case SCS_SYST_CVR:
+    {
+      scs->reg.syst_cvr = 0;
+      scs->reg.syst_csr &= ~SCS_SYST_CSR_COUNTFLAG;
+
+      if (scs->reg.syst_csr & SCS_SYST_CSR_ENABLE)
+        scs_syst_start(scs, 0);
+    } break;
+
+    case SCS_NVIC_ISER:
+    {
+      core->irq_en |= data & ~SCS_SYS_TICK_MASK;
+    } break;
+
+    case SCS_NVIC_ICER:
+    {
+      core->irq_en &= ~(data & ~SCS_SYS_TICK_MASK);
+    } break;
+
+    case SCS_ICSR:
+    {
+      if (data & SCS_ICSR_PENDSTSET)
+        soc_irq_set(SOC(scs), CORE_IRQ_SYS_TICK);
+      else if (data & SCS_ICSR_PENDSTCLR)
+        soc_irq_clear(SOC(scs), CORE_IRQ_SYS_TICK);
+    } break;
+
+    case SCS_SCR:
+    {
+      scs->reg.scr = data & (SCS_SCR_SLEEPONEXIT | SCS_SCR_SLEEPDEEP | SCS_SCR_SEVONPEND);
+      core->ext->sleep_on_exit = (0 != (data & SCS_SCR_SLEEPONEXIT));
+    } break;
+
+    case SCS_SHPR2:
+    {
+      scs->reg.shpr2 = data;
+    } break;
+
+    case SCS_SHPR3:
+    {
+      scs->reg.shpr3 = data;
+    } break;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void scs_syst_event_cb(event_t *event)
+{
+  scs_t *scs = (scs_t *)event->data;
+
+  scs->reg.syst_csr |= SCS_SYST_CSR_COUNTFLAG;
+
+  if (scs->reg.syst_csr & SCS_SYST_CSR_TICKINT)
+    soc_irq_set(SOC(scs), CORE_IRQ_SYS_TICK);
+
+  if (scs->reg.syst_rvr)
+  {
+    scs->reload = event->time + 1;
+    event->timeout = scs->reg.syst_rvr + 1;
+    events_add(event);
+  }
+}
+
+//-----------------------------------------------------------------------------
+io_ops_t scs_ops =
+{
+  .read_b  = (io_read_b_t)NULL,
+  .read_h  = (io_read_h_t)NULL,
+  .read_w  = (io_read_w_t)scs_read_w,
+  .write_b = (io_write_b_t)NULL,
+  .write_h = (io_write_h_t)NULL,
+  .write_w = (io_write_w_t)scs_write_w,
+};
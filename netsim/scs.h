@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCS_H_
+#define _SCS_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include "io_ops.h"
+#include "events.h"
+
+/*- Types -------------------------------------------------------------------*/
+enum
+{
+  SCS_SYST_CSR         = 0xe010,
+  SCS_SYST_RVR         = 0xe014,
+  SCS_SYST_CVR         = 0xe018,
+  SCS_SYST_CALIB       = 0xe01c,
+  SCS_NVIC_ISER        = 0xe100,
+  SCS_NVIC_ICER        = 0xe180,
+  SCS_CPUID            = 0xed00,
+  SCS_ICSR             = 0xed04,
+  SCS_SCR              = 0xed10,
+  SCS_SHPR2            = 0xed1c,
+  SCS_SHPR3            = 0xed20,
+};
+
+enum
+{
+  SCS_SYST_CSR_ENABLE          = (1 << 0),
+  SCS_SYST_CSR_TICKINT         = (1 << 1),
+  SCS_SYST_CSR_CLKSOURCE       = (1 << 2),
+  SCS_SYST_CSR_COUNTFLAG       = (1 << 16),
+};
+
+enum
+{
+  SCS_ICSR_PENDSTCLR           = (1 << 25),
+  SCS_ICSR_PENDSTSET           = (1 << 26),
+};
+
+enum
+{
+  SCS_SCR_SLEEPONEXIT          = (1 << 1),
+  SCS_SCR_SLEEPDEEP            = (1 << 2),
+  SCS_SCR_SEVONPEND            = (1 << 4),
+};
+
+typedef struct
+{
+  void         *soc;
+  event_t      event;
+  uint64_t     reload;   // SysTick counts from this cycle on
+
+  struct
+  {
+    uint32_t   syst_csr;
+    uint32_t   syst_rvr;
+    uint32_t   syst_cvr; // Only valid while SysTick is disabled
+    uint32_t   scr;
+    uint32_t   shpr2;
+    uint32_t   shpr3;
+  } reg;
+} scs_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+void scs_init(scs_t *scs);
+
+/*- Variables ---------------------------------------------------------------*/
+extern io_ops_t scs_ops;
+
+#endif // _SCS_H_
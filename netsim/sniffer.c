@@ -73,7 +73,7 @@ void sniffer_write_frame(sniffer_t *sniffer, uint8_t *data, float power)
 
   // seq, time, size, data, lqi, crc_ok, power, channel, ?, duplicate, timestamp_sync, device_id
   len = sprintf(str, "%d %.6f %d %s 255 1 %d 15 0 0 1 32767\r\n",
-      sniffer->seq++, g_sim.cycle / 1000000.0, size, data_str, (int)lround(power));
+      sniffer->seq++, g_part->cycle / 1000000.0, size, data_str, (int)lround(power));
 
   sniffer_write(sniffer, str, len);
 }
@@ -16,7 +16,14 @@
  */
 
 /*- Includes ----------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 #include "io_ops.h"
 #include "soc.h"
 #include "trx.h"
@@ -25,9 +32,23 @@
 #include "medium.h"
 #include "sys_ctrl.h"
 #include "sys_timer.h"
+#include "scs.h"
 
 /*- Definitions -------------------------------------------------------------*/
-#define GET_PC(soc)    (((soc)->core.r[15] & ~1) - 2)
+#define GET_PC(soc)    (((soc)->core->r[15] & ~1) - 2)
+
+/*- Types -------------------------------------------------------------------*/
+#ifdef __linux__
+// Firmware images are loaded once per path into anonymous files, which are
+// mapped copy-on-write into each node running them
+typedef struct firmware_t
+{
+  struct firmware_t *next;
+  char         *path;
+  int          fd;
+  int          size;
+} firmware_t;
+#endif
 
 /*- Prototypes --------------------------------------------------------------*/
 static uint8_t soc_unhandled_read_b(soc_t *soc, uint32_t addr);
@@ -39,6 +60,9 @@ static void soc_unhandled_write_w(soc_t *soc, uint32_t addr, uint32_t data);
 
 /*- Variables ---------------------------------------------------------------*/
 static io_ops_t soc_peripherals[SOC_PERIPHERALS_SIZE];
+#ifdef __linux__
+static firmware_t *soc_firmwares = NULL;
+#endif
 static io_ops_t soc_unhandled_ops =
 {
   .read_b  = (io_read_b_t)soc_unhandled_read_b,
@@ -65,6 +89,104 @@ void soc_setup(void)
   soc_peripherals[SOC_ID_SYS_TIMER_2] = sys_timer_ops;
   soc_peripherals[SOC_ID_SYS_TIMER_3] = sys_timer_ops;
   soc_peripherals[SOC_ID_TRX]         = trx_ops;
+  soc_peripherals[SOC_ID_SCS]         = scs_ops;
+}
+
+//-----------------------------------------------------------------------------
+static uint8_t *soc_read_file(char *path, int *size)
+{
+  struct stat st;
+  uint8_t *data;
+  int f;
+
+  f = open(path, O_RDONLY);
+
+  if (f < 0 || fstat(f, &st) < 0)
+    error("cannot open firmware file %s", path);
+
+  if (st.st_size >= CORE_MEM_LIMIT)
+    error("firmware file %s is too big", path);
+
+  data = sim_malloc(st.st_size + 1);
+  *size = read(f, data, st.st_size);
+  close(f);
+
+  if (*size != st.st_size)
+    error("cannot read firmware file %s", path);
+
+  return data;
+}
+
+#ifdef __linux__
+//-----------------------------------------------------------------------------
+static firmware_t *soc_firmware(char *path)
+{
+  firmware_t *firmware;
+  uint8_t *data;
+
+  for (firmware = soc_firmwares; firmware; firmware = firmware->next)
+  {
+    if (0 == strcmp(firmware->path, path))
+      return firmware;
+  }
+
+  firmware = sim_malloc(sizeof(firmware_t));
+  firmware->path = path;
+  data = soc_read_file(path, &firmware->size);
+  firmware->fd = memfd_create(path, 0);
+
+  if (firmware->fd < 0 || firmware->size != write(firmware->fd, data, firmware->size))
+    error("cannot store firmware file %s", path);
+
+  sim_free(data);
+
+  firmware->next = soc_firmwares;
+  soc_firmwares = firmware;
+
+  return firmware;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+void soc_load(soc_t *soc, uint32_t flash_size, uint32_t ram_size)
+{
+  core_t *core = core_alloc();
+#ifdef __linux__
+  firmware_t *firmware = soc_firmware(soc->path);
+  long page = sysconf(_SC_PAGESIZE);
+  long size = (firmware->size + page - 1) & ~(page - 1);
+#else
+  int size;
+  uint8_t *data = soc_read_file(soc->path, &size);
+#endif
+
+  soc->core = core;
+  core->flash_size = flash_size;
+  core->mem_size = flash_size + ram_size;
+
+#ifdef __linux__
+  if (firmware->size >= (int)core->mem_size)
+    error("firmware file %s is too big", soc->path);
+
+  // The memory is only reserved, pages are committed when first touched.
+  // The firmware is mapped copy-on-write over its beginning.
+  core->ram = mmap(NULL, core->mem_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (MAP_FAILED == core->ram)
+    error("out of memory");
+
+  if (size > 0 && MAP_FAILED == mmap(core->ram, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, firmware->fd, 0))
+    error("cannot map firmware file %s", soc->path);
+#else
+  if (size >= (int)core->mem_size)
+    error("firmware file %s is too big", soc->path);
+
+  core->ram = sim_malloc(core->mem_size);
+  memcpy(core->ram, data, size);
+  sim_free(data);
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -79,10 +201,11 @@ void soc_init(soc_t *soc)
   soc->peripherals[SOC_ID_SYS_TIMER_2] = &soc->sys_timer[2];
   soc->peripherals[SOC_ID_SYS_TIMER_3] = &soc->sys_timer[3];
   soc->peripherals[SOC_ID_TRX]         = &soc->trx;
+  soc->peripherals[SOC_ID_SCS]         = &soc->scs;
 
-  soc->core.soc = soc;
-  soc->core.name = soc->name;
-  core_init(&soc->core);
+  soc->core->soc = soc;
+  soc->core->name = soc->name;
+  core_init(soc->core);
 
   soc->trx.soc = soc;
   soc->trx.name = soc->name;
@@ -92,6 +215,9 @@ void soc_init(soc_t *soc)
   soc->trx.irq = SOC_IRQ_TRX;
   trx_init(&soc->trx);
 
+  core_map(soc->core, (SOC_ID_TRX << SOC_PERIPHERAL_OFFSET) | TRX_FRAME_START_REG,
+      sizeof(soc->trx.buf), soc->trx.buf, true);
+
   soc->sys_ctrl.soc = soc;
   sys_ctrl_init(&soc->sys_ctrl);
 
@@ -102,31 +228,35 @@ void soc_init(soc_t *soc)
     sys_timer_init(&soc->sys_timer[i]);
   }
 
+  soc->scs.soc = soc;
+  scs_init(&soc->scs);
+
   queue_add(&g_sim.trxs, &soc->trx);
 }
 
 //-----------------------------------------------------------------------------
-void soc_clk(soc_t *soc)
+void soc_irq_set(soc_t *soc, int irq)
 {
-  core_clk(&soc->core);
+  core_irq_set(soc->core, irq);
 }
 
 //-----------------------------------------------------------------------------
-void soc_irq_set(soc_t *soc, int irq)
+void soc_irq_clear(soc_t *soc, int irq)
 {
-  core_irq_set(&soc->core, irq);
+  core_irq_clear(soc->core, irq);
 }
 
 //-----------------------------------------------------------------------------
-void soc_irq_clear(soc_t *soc, int irq)
+void soc_park_check(void)
 {
-  core_irq_clear(&soc->core, irq);
+  core_park_check();
 }
 
 //-----------------------------------------------------------------------------
 uint8_t soc_read_b(soc_t *soc, uint32_t addr)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   return soc_peripherals[id].read_b(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK);
 }
 
@@ -134,6 +264,7 @@ uint8_t soc_read_b(soc_t *soc, uint32_t addr)
 uint16_t soc_read_h(soc_t *soc, uint32_t addr)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   return soc_peripherals[id].read_h(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK);
 }
 
@@ -141,6 +272,7 @@ uint16_t soc_read_h(soc_t *soc, uint32_t addr)
 uint32_t soc_read_w(soc_t *soc, uint32_t addr)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   return soc_peripherals[id].read_w(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK);
 }
 
@@ -148,21 +280,27 @@ uint32_t soc_read_w(soc_t *soc, uint32_t addr)
 void soc_write_b(soc_t *soc, uint32_t addr, uint8_t data)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   soc_peripherals[id].write_b(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK, data);
+  core_park_check();
 }
 
 //-----------------------------------------------------------------------------
 void soc_write_h(soc_t *soc, uint32_t addr, uint16_t data)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   soc_peripherals[id].write_h(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK, data);
+  core_park_check();
 }
 
 //-----------------------------------------------------------------------------
 void soc_write_w(soc_t *soc, uint32_t addr, uint32_t data)
 {
   uint8_t id = addr >> SOC_PERIPHERAL_OFFSET;
+  CORE_STATS(soc->core, mmio[id]);
   soc_peripherals[id].write_w(soc->peripherals[id], addr & SOC_PERIPHERAL_MASK, data);
+  core_park_check();
 }
 
 //-----------------------------------------------------------------------------
@@ -22,6 +22,7 @@
 #include "trx.h"
 #include "sys_ctrl.h"
 #include "sys_timer.h"
+#include "scs.h"
 #include "utils.h"
 #include "core.h"
 
@@ -44,10 +45,12 @@ typedef struct soc_t
   char         *path;
 
   long         uid;
-  core_t       core;
+  void         *part;
+  core_t       *core;
   sys_ctrl_t   sys_ctrl;
   sys_timer_t  sys_timer[4];
   trx_t        trx;
+  scs_t        scs;
 
   void         *peripherals[SOC_PERIPHERALS_SIZE];
 } soc_t;
@@ -60,6 +63,7 @@ enum
   SOC_ID_SYS_TIMER_2   = 0x04,
   SOC_ID_SYS_TIMER_3   = 0x05,
   SOC_ID_TRX           = 0x40,
+  SOC_ID_SCS           = 0xe0,
 };
 
 enum
@@ -73,10 +77,11 @@ enum
 
 /*- Prototypes --------------------------------------------------------------*/
 void soc_setup(void);
+void soc_load(soc_t *soc, uint32_t flash_size, uint32_t ram_size);
 void soc_init(soc_t *soc);
-void soc_clk(soc_t *soc);
 void soc_irq_set(soc_t *soc, int irq);
 void soc_irq_clear(soc_t *soc, int irq);
+void soc_park_check(void);
 
 uint8_t soc_read_b(soc_t *soc, uint32_t addr);
 uint16_t soc_read_h(soc_t *soc, uint32_t addr);
@@ -16,6 +16,8 @@
  */
 
 /*- Includes ----------------------------------------------------------------*/
+#include <stdbool.h>
+#include <string.h>
 #include "io_ops.h"
 #include "main.h"
 #include "soc.h"
@@ -23,12 +25,122 @@
 #include "utils.h"
 #include "sys_ctrl.h"
 
+/*- Definitions -------------------------------------------------------------*/
+#define GET_PC(soc)    (((soc)->core->r[15] & ~1) - 2)
+
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
 void sys_ctrl_init(sys_ctrl_t *sys_ctrl)
 {
-  (void)sys_ctrl;
+  sys_ctrl->src    = 0;
+  sys_ctrl->dst    = 0;
+  sys_ctrl->size   = 0;
+  sys_ctrl->value  = 0;
+  sys_ctrl->result = 0;
+}
+
+//-----------------------------------------------------------------------------
+static uint8_t *sys_ctrl_buffer(sys_ctrl_t *sys_ctrl, uint32_t addr, bool write)
+{
+  soc_t *soc = SOC(sys_ctrl);
+  core_t *core = soc->core;
+  uint32_t start = write ? core->flash_size : 0;
+
+  if (addr < start || addr > core->mem_size || sys_ctrl->size > core->mem_size - addr)
+    error("%s: 0x%08x: invalid hypercall buffer 0x%08x (%u bytes)",
+        soc->name, GET_PC(soc), addr, sys_ctrl->size);
+
+  return &core->ram[addr];
+}
+
+//-----------------------------------------------------------------------------
+static uint32_t sys_ctrl_crc16(uint32_t crc, uint8_t *data, uint32_t size)
+{
+  // CRC-16/CCITT as used by the radio (reflected, polynomial 0x1021)
+  crc &= 0xffff;
+
+  for (uint32_t i = 0; i < size; i++)
+  {
+    uint8_t byte = data[i] ^ (crc & 0xff);
+
+    byte ^= byte << 4;
+    crc = ((((uint16_t)byte << 8) | (crc >> 8)) ^ (uint8_t)(byte >> 4) ^
+        ((uint16_t)byte << 3)) & 0xffff;
+  }
+
+  return crc;
+}
+
+//-----------------------------------------------------------------------------
+static uint32_t sys_ctrl_crc32(uint32_t crc, uint8_t *data, uint32_t size)
+{
+  // CRC-32 (IEEE 802.3), the result can be passed back to continue
+  crc = ~crc;
+
+  for (uint32_t i = 0; i < size; i++)
+  {
+    crc ^= data[i];
+
+    for (int j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+
+  return ~crc;
+}
+
+//-----------------------------------------------------------------------------
+static void sys_ctrl_call(sys_ctrl_t *sys_ctrl, uint32_t cmd)
+{
+  soc_t *soc = SOC(sys_ctrl);
+  uint32_t size = sys_ctrl->size;
+  uint8_t *src, *dst;
+  int res;
+
+  switch (cmd)
+  {
+    case SYS_CTRL_CALL_MEMCPY:
+    {
+      src = sys_ctrl_buffer(sys_ctrl, sys_ctrl->src, false);
+      dst = sys_ctrl_buffer(sys_ctrl, sys_ctrl->dst, true);
+      memmove(dst, src, size);
+      sys_ctrl->result = sys_ctrl->dst;
+    } break;
+
+    case SYS_CTRL_CALL_MEMSET:
+    {
+      dst = sys_ctrl_buffer(sys_ctrl, sys_ctrl->dst, true);
+      memset(dst, sys_ctrl->value, size);
+      sys_ctrl->result = sys_ctrl->dst;
+    } break;
+
+    case SYS_CTRL_CALL_MEMCMP:
+    {
+      src = sys_ctrl_buffer(sys_ctrl, sys_ctrl->src, false);
+      dst = sys_ctrl_buffer(sys_ctrl, sys_ctrl->dst, false);
+      res = memcmp(src, dst, size);
+      sys_ctrl->result = (res > 0) - (res < 0);
+    } break;
+
+    case SYS_CTRL_CALL_CRC16:
+    {
+      src = sys_ctrl_buffer(sys_ctrl, sys_ctrl->src, false);
+      sys_ctrl->result = sys_ctrl_crc16(sys_ctrl->value, src, size);
+    } break;
+
+    case SYS_CTRL_CALL_CRC32:
+    {
+      src = sys_ctrl_buffer(sys_ctrl, sys_ctrl->src, false);
+      sys_ctrl->result = sys_ctrl_crc32(sys_ctrl->value, src, size);
+    } break;
+
+    default:
+      error("%s: 0x%08x: invalid hypercall %u", soc->name, GET_PC(soc), cmd);
+  }
+
+  // The call completes at once, the core is charged for the time it would
+  // take to do the same work in hardware
+  core_wait(soc->core, g_sim.call_cycles + (int)(size * g_sim.call_byte_cycles));
 }
 
 //-----------------------------------------------------------------------------
@@ -49,7 +161,22 @@ static uint32_t sys_ctrl_read_w(sys_ctrl_t *sys_ctrl, uint32_t addr)
 
     case SYS_CTRL_INTENSET:
     case SYS_CTRL_INTENCLR:
-      return soc->core.irq_en;
+      return soc->core->irq_en & ~(1u << CORE_IRQ_SYS_TICK);
+
+    case SYS_CTRL_CALL_SRC:
+      return sys_ctrl->src;
+
+    case SYS_CTRL_CALL_DST:
+      return sys_ctrl->dst;
+
+    case SYS_CTRL_CALL_SIZE:
+      return sys_ctrl->size;
+
+    case SYS_CTRL_CALL_VALUE:
+      return sys_ctrl->value;
+
+    case SYS_CTRL_CALL_RESULT:
+      return sys_ctrl->result;
   }
 
   return 0;
@@ -64,21 +191,46 @@ static void sys_ctrl_write_w(sys_ctrl_t *sys_ctrl, uint32_t addr, uint32_t data)
   {
     case SYS_CTRL_LOG:
     {
-      if (data < CORE_RAM_SIZE)
+      if (data < soc->core->mem_size)
       {
-        char *str = (char *)&soc->core.ram[data];
+        char *str = (char *)&soc->core->ram[data];
         LOG_DBG(soc, "%s", str);
       }
     } break;
 
     case SYS_CTRL_INTENSET:
     {
-      soc->core.irq_en |= data;
+      soc->core->irq_en |= data & ~(1u << CORE_IRQ_SYS_TICK);
     } break;
 
     case SYS_CTRL_INTENCLR:
     {
-      soc->core.irq_en &= ~data;
+      soc->core->irq_en &= ~(data & ~(1u << CORE_IRQ_SYS_TICK));
+    } break;
+
+    case SYS_CTRL_CALL_SRC:
+    {
+      sys_ctrl->src = data;
+    } break;
+
+    case SYS_CTRL_CALL_DST:
+    {
+      sys_ctrl->dst = data;
+    } break;
+
+    case SYS_CTRL_CALL_SIZE:
+    {
+      sys_ctrl->size = data;
+    } break;
+
+    case SYS_CTRL_CALL_VALUE:
+    {
+      sys_ctrl->value = data;
+    } break;
+
+    case SYS_CTRL_CALL_CMD:
+    {
+      sys_ctrl_call(sys_ctrl, data);
     } break;
   }
 }
@@ -31,11 +31,32 @@ enum
   SYS_CTRL_LOG         = 0x0c,
   SYS_CTRL_INTENSET    = 0x10,
   SYS_CTRL_INTENCLR    = 0x14,
+  SYS_CTRL_CALL_SRC    = 0x18,
+  SYS_CTRL_CALL_DST    = 0x1c,
+  SYS_CTRL_CALL_SIZE   = 0x20,
+  SYS_CTRL_CALL_VALUE  = 0x24,
+  SYS_CTRL_CALL_CMD    = 0x28,
+  SYS_CTRL_CALL_RESULT = 0x2c,
+};
+
+enum
+{
+  SYS_CTRL_CALL_MEMCPY = 1,
+  SYS_CTRL_CALL_MEMSET = 2,
+  SYS_CTRL_CALL_MEMCMP = 3,
+  SYS_CTRL_CALL_CRC16  = 4,
+  SYS_CTRL_CALL_CRC32  = 5,
 };
 
 typedef struct
 {
   void         *soc;
+
+  uint32_t     src;
+  uint32_t     dst;
+  uint32_t     size;
+  uint32_t     value;
+  uint32_t     result;
 } sys_ctrl_t;
 
 /*- Prototypes --------------------------------------------------------------*/
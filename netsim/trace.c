@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "soc.h"
+#include "main.h"
+#include "utils.h"
+#include "trace.h"
+
+/*- Prototypes --------------------------------------------------------------*/
+static void trace_write(trace_t *trace, const void *data, int size);
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void trace_init(trace_t *trace)
+{
+  core_t *core = ((soc_t *)trace->soc)->core;
+  trace_header_t header;
+
+  trace->fd = open(trace->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (trace->fd < 0)
+    error("cannot create trace output file %s", trace->path);
+
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(trace_record_t);
+  header.reserved = 0;
+  trace_write(trace, &header, sizeof(header));
+
+  trace->buffer = (trace_record_t *)sim_malloc(TRACE_BUFFER_SIZE * sizeof(trace_record_t));
+  trace->count = 0;
+
+  core->ext->trace = trace;
+  core->traced = true;
+}
+
+//-----------------------------------------------------------------------------
+void trace_flush(trace_t *trace)
+{
+  trace_write(trace, trace->buffer, trace->count * sizeof(trace_record_t));
+  trace->count = 0;
+}
+
+//-----------------------------------------------------------------------------
+void trace_finish(void)
+{
+  queue_foreach(trace_t, trace, &g_sim.traces)
+  {
+    trace_flush(trace);
+    close(trace->fd);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void trace_write(trace_t *trace, const void *data, int size)
+{
+  const uint8_t *ptr = (const uint8_t *)data;
+
+  while (size > 0)
+  {
+    int n = write(trace->fd, ptr, size);
+
+    if (n <= 0)
+      error("cannot write to trace output file %s", trace->path);
+
+    ptr += n;
+    size -= n;
+  }
+}
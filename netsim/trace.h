@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include "utils.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define TRACE_MAGIC        0x5254534e // "NSTR"
+#define TRACE_VERSION      1
+#define TRACE_BUFFER_SIZE  65536 // Records written to the file at once
+
+#define TRACE_MORE         0x10 // More than one register has changed
+
+enum
+{
+  TRACE_EXCEPTION = 0xfe, // Exception entry, value is the exception number
+  TRACE_NONE      = 0xff, // No register has changed
+};
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t     magic;
+  uint32_t     version;
+  uint32_t     record_size;
+  uint32_t     reserved;
+} trace_header_t;
+
+// 32-bit instructions have the first halfword in the upper half of opcode
+typedef struct
+{
+  uint64_t     cycle;
+  uint32_t     pc;
+  uint32_t     opcode;
+  uint32_t     value;    // New value of the register
+  uint8_t      reg;      // Lowest changed register, except PC
+  uint8_t      flags;    // NZCV in bits 3..0 and TRACE_MORE
+  uint16_t     reserved;
+} trace_record_t;
+
+typedef struct trace_t
+{
+  queue_t      queue;
+
+  void         *soc;
+  char         *path;
+
+  int          fd;
+  int          count;
+  trace_record_t *buffer;
+} trace_t;
+
+/*- Prototypes --------------------------------------------------------------*/
+void trace_init(trace_t *trace);
+void trace_flush(trace_t *trace);
+void trace_finish(void);
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static inline trace_record_t *trace_next(trace_t *trace)
+{
+  if (TRACE_BUFFER_SIZE == trace->count)
+    trace_flush(trace);
+
+  return &trace->buffer[trace->count++];
+}
+
+#endif // _TRACE_H_
+
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2014-2017, Alex Taradov <alex@taradov.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../main.h"
+#include "../utils.h"
+#include "../trace.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define ARRAY_SIZE(a)   (sizeof(a) / sizeof(a[0]))
+#define BITS(x, s, n)   (((x) >> (s)) & ((1 << (n)) - 1))
+
+/*- Types -------------------------------------------------------------------*/
+// Operands are described by the format string:
+//   %d, %n, %m, %t -- low register at bit 0, 3, 6 or 8
+//   %D, %M         -- high register at bits 7:2-0 or 6-3
+//   %3, %5, %8     -- immediate of 3, 5 or 8 bits
+//   %H, %W, %w, %7 -- imm5 * 2, imm5 * 4, imm8 * 4, imm7 * 4
+//   %l, %p, %P     -- register list, for push with LR, for pop with PC
+//   %c, %B, %J     -- condition, conditional and unconditional branch target
+typedef struct
+{
+  uint16_t     mask;
+  uint16_t     value;
+  const char   *format;
+} instr_t;
+
+/*- Variables ---------------------------------------------------------------*/
+sim_t g_sim;
+__thread part_t *g_part = &g_sim.part;
+
+static const instr_t instructions[] =
+{
+  { 0xf800, 0x0000, "lsls\t%d, %n, #%5" },
+  { 0xf800, 0x0800, "lsrs\t%d, %n, #%5" },
+  { 0xf800, 0x1000, "asrs\t%d, %n, #%5" },
+  { 0xfe00, 0x1800, "adds\t%d, %n, %m" },
+  { 0xfe00, 0x1a00, "subs\t%d, %n, %m" },
+  { 0xfe00, 0x1c00, "adds\t%d, %n, #%3" },
+  { 0xfe00, 0x1e00, "subs\t%d, %n, #%3" },
+  { 0xf800, 0x2000, "movs\t%t, #%8" },
+  { 0xf800, 0x2800, "cmp\t%t, #%8" },
+  { 0xf800, 0x3000, "adds\t%t, #%8" },
+  { 0xf800, 0x3800, "subs\t%t, #%8" },
+
+  { 0xffc0, 0x4000, "ands\t%d, %n" },
+  { 0xffc0, 0x4040, "eors\t%d, %n" },
+  { 0xffc0, 0x4080, "lsls\t%d, %n" },
+  { 0xffc0, 0x40c0, "lsrs\t%d, %n" },
+  { 0xffc0, 0x4100, "asrs\t%d, %n" },
+  { 0xffc0, 0x4140, "adcs\t%d, %n" },
+  { 0xffc0, 0x4180, "sbcs\t%d, %n" },
+  { 0xffc0, 0x41c0, "rors\t%d, %n" },
+  { 0xffc0, 0x4200, "tst\t%d, %n" },
+  { 0xffc0, 0x4240, "rsbs\t%d, %n, #0" },
+  { 0xffc0, 0x4280, "cmp\t%d, %n" },
+  { 0xffc0, 0x42c0, "cmn\t%d, %n" },
+  { 0xffc0, 0x4300, "orrs\t%d, %n" },
+  { 0xffc0, 0x4340, "muls\t%d, %n, %d" },
+  { 0xffc0, 0x4380, "bics\t%d, %n" },
+  { 0xffc0, 0x43c0, "mvns\t%d, %n" },
+
+  { 0xff00, 0x4400, "add\t%D, %M" },
+  { 0xff00, 0x4500, "cmp\t%D, %M" },
+  { 0xff00, 0x4600, "mov\t%D, %M" },
+  { 0xff87, 0x4700, "bx\t%M" },
+  { 0xff87, 0x4780, "blx\t%M" },
+
+  { 0xf800, 0x4800, "ldr\t%t, [pc, #%w]" },
+
+  { 0xfe00, 0x5000, "str\t%d, [%n, %m]" },
+  { 0xfe00, 0x5200, "strh\t%d, [%n, %m]" },
+  { 0xfe00, 0x5400, "strb\t%d, [%n, %m]" },
+  { 0xfe00, 0x5600, "ldrsb\t%d, [%n, %m]" },
+  { 0xfe00, 0x5800, "ldr\t%d, [%n, %m]" },
+  { 0xfe00, 0x5a00, "ldrh\t%d, [%n, %m]" },
+  { 0xfe00, 0x5c00, "ldrb\t%d, [%n, %m]" },
+  { 0xfe00, 0x5e00, "ldrsh\t%d, [%n, %m]" },
+  { 0xf800, 0x6000, "str\t%d, [%n, #%W]" },
+  { 0xf800, 0x6800, "ldr\t%d, [%n, #%W]" },
+  { 0xf800, 0x7000, "strb\t%d, [%n, #%5]" },
+  { 0xf800, 0x7800, "ldrb\t%d, [%n, #%5]" },
+  { 0xf800, 0x8000, "strh\t%d, [%n, #%H]" },
+  { 0xf800, 0x8800, "ldrh\t%d, [%n, #%H]" },
+  { 0xf800, 0x9000, "str\t%t, [sp, #%w]" },
+  { 0xf800, 0x9800, "ldr\t%t, [sp, #%w]" },
+
+  { 0xf800, 0xa000, "add\t%t, pc, #%w" },
+  { 0xf800, 0xa800, "add\t%t, sp, #%w" },
+
+  { 0xff80, 0xb000, "add\tsp, #%7" },
+  { 0xff80, 0xb080, "sub\tsp, #%7" },
+  { 0xffc0, 0xb200, "sxth\t%d, %n" },
+  { 0xffc0, 0xb240, "sxtb\t%d, %n" },
+  { 0xffc0, 0xb280, "uxth\t%d, %n" },
+  { 0xffc0, 0xb2c0, "uxtb\t%d, %n" },
+  { 0xfe00, 0xb400, "push\t%p" },
+  { 0xfe00, 0xbc00, "pop\t%P" },
+  { 0xffff, 0xb662, "cpsie\ti" },
+  { 0xffff, 0xb672, "cpsid\ti" },
+  { 0xffc0, 0xba00, "rev\t%d, %n" },
+  { 0xffc0, 0xba40, "rev16\t%d, %n" },
+  { 0xffc0, 0xbac0, "revsh\t%d, %n" },
+  { 0xff00, 0xbe00, "bkpt\t#%8" },
+  { 0xffff, 0xbf00, "nop" },
+  { 0xffff, 0xbf10, "yield" },
+  { 0xffff, 0xbf20, "wfe" },
+  { 0xffff, 0xbf30, "wfi" },
+  { 0xffff, 0xbf40, "sev" },
+
+  { 0xf800, 0xc000, "stm\t%t!, %l" },
+  { 0xf800, 0xc800, "ldm\t%t!, %l" },
+
+  { 0xff00, 0xde00, "udf\t#%8" },
+  { 0xff00, 0xdf00, "svc\t#%8" },
+  { 0xf000, 0xd000, "b%c\t%B" },
+
+  { 0xf800, 0xe000, "b\t%J" },
+};
+
+static const char *regs[16] =
+{
+  "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+  "r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc",
+};
+
+static const char *conds[16] =
+{
+  "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+  "hi", "ls", "ge", "lt", "gt", "le", "", "",
+};
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static int print_list(char *str, uint32_t list)
+{
+  int len = 0;
+
+  len += sprintf(&str[len], "{");
+
+  for (int i = 0; i < 16; i++)
+  {
+    if (list & (1 << i))
+      len += sprintf(&str[len], "%s%s", (len > 1) ? ", " : "", regs[i]);
+  }
+
+  return len + sprintf(&str[len], "}");
+}
+
+//-----------------------------------------------------------------------------
+static void disasm_16bit(char *str, uint32_t pc, uint16_t op)
+{
+  const instr_t *instr = NULL;
+  const char *fmt;
+  int len = 0;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(instructions); i++)
+  {
+    if (instructions[i].value == (op & instructions[i].mask))
+    {
+      instr = &instructions[i];
+      break;
+    }
+  }
+
+  if (NULL == instr)
+  {
+    sprintf(str, "%-8s0x%04x", ".short", op);
+    return;
+  }
+
+  for (fmt = instr->format; *fmt; fmt++)
+  {
+    int32_t offset;
+
+    if ('\t' == *fmt)
+    {
+      len += sprintf(&str[len], "%*s", 8 - len, "");
+      continue;
+    }
+    else if ('%' != *fmt)
+    {
+      str[len++] = *fmt;
+      continue;
+    }
+
+    switch (*++fmt)
+    {
+      case 'd': len += sprintf(&str[len], "%s", regs[BITS(op, 0, 3)]); break;
+      case 'n': len += sprintf(&str[len], "%s", regs[BITS(op, 3, 3)]); break;
+      case 'm': len += sprintf(&str[len], "%s", regs[BITS(op, 6, 3)]); break;
+      case 't': len += sprintf(&str[len], "%s", regs[BITS(op, 8, 3)]); break;
+      case 'D': len += sprintf(&str[len], "%s", regs[(BITS(op, 7, 1) << 3) | BITS(op, 0, 3)]); break;
+      case 'M': len += sprintf(&str[len], "%s", regs[BITS(op, 3, 4)]); break;
+      case '3': len += sprintf(&str[len], "%d", BITS(op, 6, 3)); break;
+      case '5': len += sprintf(&str[len], "%d", BITS(op, 6, 5)); break;
+      case '8': len += sprintf(&str[len], "%d", BITS(op, 0, 8)); break;
+      case 'H': len += sprintf(&str[len], "%d", BITS(op, 6, 5) * 2); break;
+      case 'W': len += sprintf(&str[len], "%d", BITS(op, 6, 5) * 4); break;
+      case 'w': len += sprintf(&str[len], "%d", BITS(op, 0, 8) * 4); break;
+      case '7': len += sprintf(&str[len], "%d", BITS(op, 0, 7) * 4); break;
+      case 'l': len += print_list(&str[len], BITS(op, 0, 8)); break;
+      case 'p': len += print_list(&str[len], BITS(op, 0, 8) | (BITS(op, 8, 1) << 14)); break;
+      case 'P': len += print_list(&str[len], BITS(op, 0, 8) | (BITS(op, 8, 1) << 15)); break;
+      case 'c': len += sprintf(&str[len], "%s", conds[BITS(op, 8, 4)]); break;
+
+      case 'B':
+        offset = (int8_t)BITS(op, 0, 8) * 2;
+        len += sprintf(&str[len], "0x%08x", pc + 4 + offset);
+        break;
+
+      case 'J':
+        offset = BITS(op, 0, 11) * 2;
+        offset = (offset & 0x800) ? (offset - 0x1000) : offset;
+        len += sprintf(&str[len], "0x%08x", pc + 4 + offset);
+        break;
+    }
+  }
+
+  str[len] = 0;
+}
+
+//-----------------------------------------------------------------------------
+static const char *sysm_name(int sysm)
+{
+  switch (sysm)
+  {
+    case 0: return "apsr";
+    case 1: return "iapsr";
+    case 2: return "eapsr";
+    case 3: return "xpsr";
+    case 5: return "ipsr";
+    case 6: return "epsr";
+    case 7: return "iepsr";
+    case 8: return "msp";
+    case 9: return "psp";
+    case 16: return "primask";
+    case 20: return "control";
+  }
+
+  return "?";
+}
+
+//-----------------------------------------------------------------------------
+static void disasm_32bit(char *str, uint32_t pc, uint32_t op)
+{
+  static const char *barriers[] = { "dsb", "dmb", "isb" };
+
+  if (0xf000d000 == (op & 0xf800d000))
+  {
+    uint32_t s = BITS(op, 26, 1);
+    uint32_t i1 = ~(BITS(op, 13, 1) ^ s) & 1;
+    uint32_t i2 = ~(BITS(op, 11, 1) ^ s) & 1;
+    uint32_t offset = (s << 24) | (i1 << 23) | (i2 << 22) | (BITS(op, 16, 10) << 12) | (BITS(op, 0, 11) << 1);
+
+    offset |= s ? 0xff000000 : 0x00000000;
+    sprintf(str, "%-8s0x%08x", "bl", pc + 4 + offset);
+  }
+  else if (0xf3ef8000 == (op & 0xfffff000))
+    sprintf(str, "%-8s%s, %s", "mrs", regs[BITS(op, 8, 4)], sysm_name(BITS(op, 0, 8)));
+  else if (0xf3808800 == (op & 0xfff0ff00))
+    sprintf(str, "%-8s%s, %s", "msr", sysm_name(BITS(op, 0, 8)), regs[BITS(op, 16, 4)]);
+  else if (0xf3bf8f40 == (op & 0xffffffc0) && BITS(op, 4, 2) < 3)
+    sprintf(str, "%-8s#%d", barriers[BITS(op, 4, 2)], BITS(op, 0, 4));
+  else if (0xf7f0a000 == (op & 0xfff0f000))
+    sprintf(str, "%-8s#%d", "udf.w", (BITS(op, 16, 4) << 12) | BITS(op, 0, 12));
+  else
+    sprintf(str, "%-8s0x%08x", ".word", op);
+}
+
+//-----------------------------------------------------------------------------
+static void print_record(trace_record_t *record)
+{
+  char str[128];
+  char flags[5];
+
+  if (TRACE_EXCEPTION == record->reg)
+  {
+    printf("%12"PRIu64"  exception %d, handler at 0x%08x\n", record->cycle,
+        record->value, record->pc);
+    return;
+  }
+
+  if (record->opcode >> 16)
+  {
+    disasm_32bit(str, record->pc, record->opcode);
+    printf("%12"PRIu64"  %08x  %04x %04x  %-28s", record->cycle, record->pc,
+        record->opcode >> 16, record->opcode & 0xffff, str);
+  }
+  else
+  {
+    disasm_16bit(str, record->pc, record->opcode);
+    printf("%12"PRIu64"  %08x  %04x       %-28s", record->cycle, record->pc,
+        record->opcode, str);
+  }
+
+  flags[0] = (record->flags & 8) ? 'N' : 'n';
+  flags[1] = (record->flags & 4) ? 'Z' : 'z';
+  flags[2] = (record->flags & 2) ? 'C' : 'c';
+  flags[3] = (record->flags & 1) ? 'V' : 'v';
+  flags[4] = 0;
+
+  printf("  %s", flags);
+
+  if (TRACE_NONE != record->reg)
+    printf("  %s=0x%08x%s", regs[record->reg & 0xf], record->value,
+        (record->flags & TRACE_MORE) ? " ..." : "");
+
+  printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  static trace_record_t records[TRACE_BUFFER_SIZE];
+  trace_header_t header;
+  size_t count;
+  FILE *f;
+
+  if (2 != argc)
+  {
+    printf("Usage: %s <trace>\n", argv[0]);
+    return 0;
+  }
+
+  f = fopen(argv[1], "rb");
+
+  if (NULL == f)
+    error("cannot open trace file %s", argv[1]);
+
+  if (1 != fread(&header, sizeof(header), 1, f) || TRACE_MAGIC != header.magic)
+    error("%s is not a trace file", argv[1]);
+
+  if (TRACE_VERSION != header.version || sizeof(trace_record_t) != header.record_size)
+    error("trace file %s has an unsupported version", argv[1]);
+
+  while ((count = fread(records, sizeof(trace_record_t), TRACE_BUFFER_SIZE, f)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
+      print_record(&records[i]);
+  }
+
+  fclose(f);
+
+  return 0;
+}
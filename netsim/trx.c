@@ -29,12 +29,6 @@
 #include "medium.h"
 
 /*- Definitions -------------------------------------------------------------*/
-#define SYMBOLS_PER_OCTET      2
-#define SYMBOL_DURATION        16 // us
-#define UNIT_BACKOFF_PERIOD    20 // symbols
-#define TURNAROUND_TIME        12 // symbols
-#define PHY_SHR_DURATION       10 // symbols
-#define PHY_PHR_DURATION       2  // symbols
 #define ACK_WAIT_DURATION      ((UNIT_BACKOFF_PERIOD + TURNAROUND_TIME + PHY_SHR_DURATION + \
                                  6*SYMBOLS_PER_OCTET) * SYMBOL_DURATION)
 #define PHY_PHR_OFFSET         0
@@ -406,9 +400,8 @@ static void trx_ack_wait_timeout_cb(event_t *event)
 }
 
 //-----------------------------------------------------------------------------
-void trx_rx_start(trx_t *trx)
+void trx_rx_start(trx_t *trx, uint8_t *data)
 {
-  uint8_t *data = trx->rx_trx->tx_data;
   int size;
 
   TRX_DBG(trx, "RX start from %s", trx->rx_trx->name);
@@ -25,6 +25,17 @@
 #include "utils.h"
 #include "events.h"
 
+/*- Definitions -------------------------------------------------------------*/
+#define SYMBOLS_PER_OCTET      2
+#define SYMBOL_DURATION        16 // us
+#define UNIT_BACKOFF_PERIOD    20 // symbols
+#define TURNAROUND_TIME        12 // symbols
+#define PHY_SHR_DURATION       10 // symbols
+#define PHY_PHR_DURATION       2  // symbols
+
+// A frame can not affect any receiver before its synchronization header is over
+#define TRX_LOOKAHEAD          (PHY_SHR_DURATION * SYMBOL_DURATION)
+
 /*- Types -------------------------------------------------------------------*/
 enum
 {
@@ -127,6 +138,7 @@ typedef struct trx_t
   int          tx_csma_ret;
   int          tx_frame_ret;
   uint8_t      tx_data[128];
+  struct medium_tx_t *tx_medium; // Frame as seen by the other parts
 
   bool         rx;
   event_t      rx_event;
@@ -170,7 +182,7 @@ typedef struct trx_t
 /*- Prototypes --------------------------------------------------------------*/
 void trx_init(trx_t *trx);
 void trx_set_state(trx_t *trx, uint8_t state);
-void trx_rx_start(trx_t *trx);
+void trx_rx_start(trx_t *trx, uint8_t *data);
 void trx_rx_end(trx_t *trx, bool normal);
 
 /*- Variables ---------------------------------------------------------------*/
@@ -29,40 +29,44 @@
 /*- Definitions -------------------------------------------------------------*/
 #define RAND_PHI   0x9e3779b9
 
-/*- Variables ---------------------------------------------------------------*/
-static uint32_t rand_state[4096];
-
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
-void rand_init(uint32_t state)
+static uint32_t rand_step(rand_t *rand)
+{
+  uint64_t t;
+ 
+  rand->i = (rand->i + 1) & (RAND_STATE_SIZE - 1);
+  t = (18705ULL * rand->state[rand->i]) + rand->c;
+  rand->c = t >> 32;
+  rand->state[rand->i] = 0xfffffffe - t;
+ 
+  return rand->state[rand->i];
+}
+
+//-----------------------------------------------------------------------------
+void rand_init(rand_t *rand, uint32_t state)
 {
-  rand_state[0] = state;
-  rand_state[1] = state + RAND_PHI;
-  rand_state[2] = state + RAND_PHI*2;
+  rand->state[0] = state;
+  rand->state[1] = state + RAND_PHI;
+  rand->state[2] = state + RAND_PHI*2;
  
-  for (int i = 3; i < 4096; i++)
-    rand_state[i] = rand_state[i - 3] ^ rand_state[i - 2] ^ RAND_PHI ^ i;
+  for (int i = 3; i < RAND_STATE_SIZE; i++)
+    rand->state[i] = rand->state[i - 3] ^ rand->state[i - 2] ^ RAND_PHI ^ i;
+
+  rand->i = RAND_STATE_SIZE - 1;
+  rand->c = 362436;
 
   // This is not a part of the original implementation, but without this
   // first 4096 generated values are not random at all
-  for (int i = 0; i < 4096; i++)
-    rand_next();
+  for (int i = 0; i < RAND_STATE_SIZE; i++)
+    rand_step(rand);
 }
 
 //-----------------------------------------------------------------------------
 uint32_t rand_next(void)
 {
-  static uint32_t i = 4095;
-  static uint32_t c = 362436;
-  uint64_t t;
- 
-  i = (i + 1) & 4095;
-  t = (18705ULL * rand_state[i]) + c;
-  c = t >> 32;
-  rand_state[i] = 0xfffffffe - t;
- 
-  return rand_state[i];
+  return rand_step(&g_part->rand);
 }
 
 //-----------------------------------------------------------------------------
@@ -74,7 +78,7 @@ float randf_next(void)
 //-----------------------------------------------------------------------------
 uint64_t get_sim_cycle(void)
 {
-  return g_sim.cycle;
+  return g_part->cycle;
 }
 
 //-----------------------------------------------------------------------------
@@ -96,6 +100,49 @@ void sim_free(void *ptr)
   free(ptr);
 }
 
+//-----------------------------------------------------------------------------
+void sim_printf(const char *fmt, ...)
+{
+  part_t *part = g_part;
+  va_list arg;
+  int size;
+
+  va_start(arg, fmt);
+
+  if (&g_sim.part == part)
+  {
+    vprintf(fmt, arg);
+    va_end(arg);
+    return;
+  }
+
+  // Nodes running on their own threads tag the lines with the time, they are
+  // printed in order at the end of the window
+  while (true)
+  {
+    int free = part->log_size - part->log_used - (int)sizeof(uint64_t);
+    va_list copy;
+
+    va_copy(copy, arg);
+    size = (free > 0) ? vsnprintf(&part->log[part->log_used + sizeof(uint64_t)], free, fmt, copy) : free;
+    va_end(copy);
+
+    if (size >= 0 && size < free)
+      break;
+
+    part->log_size = part->log_size * 2 + 1024;
+    part->log = realloc(part->log, part->log_size);
+
+    if (NULL == part->log)
+      error("out of memory");
+  }
+
+  memcpy(&part->log[part->log_used], &part->cycle, sizeof(uint64_t));
+  part->log_used += sizeof(uint64_t) + size + 1;
+
+  va_end(arg);
+}
+
 //-----------------------------------------------------------------------------
 void error(const char *fmt, ...)
 {
@@ -33,6 +33,8 @@
 
 #define MHz    1000000.0f
 
+#define RAND_STATE_SIZE    4096
+
 #define max(a, b) \
   ({ __typeof__ (a) _a = (a); \
      __typeof__ (b) _b = (b); \
@@ -45,7 +47,7 @@
 
 #define DEBUG(_name, _mod, _fmt, ...) \
   if (DEBUG_##_name) { \
-    printf("%9"PRId64" %-6s %-8s " _fmt "\r\n", g_sim.cycle, #_name, \
+    sim_printf("%9"PRId64" %-6s %-8s " _fmt "\r\n", g_part->cycle, #_name, \
         (_mod)->name, ##__VA_ARGS__); \
   }
 
@@ -64,8 +66,15 @@ typedef struct queue_t
   struct queue_t *prev;
 } queue_t;
 
+typedef struct
+{
+  uint32_t     state[RAND_STATE_SIZE];
+  uint32_t     i;
+  uint32_t     c;
+} rand_t;
+
 /*- Prototypes --------------------------------------------------------------*/
-void rand_init(uint32_t state);
+void rand_init(rand_t *rand, uint32_t state);
 uint32_t rand_next(void);
 float randf_next(void);
 
@@ -74,6 +83,7 @@ uint64_t get_sim_cycle(void);
 void *sim_malloc(int size);
 void sim_free(void *ptr);
 
+void sim_printf(const char *fmt, ...);
 void error(const char *fmt, ...);
 
 void queue_init(queue_t *queue);
@@ -88,5 +98,11 @@ static inline bool queue_is_empty(queue_t *queue)
   return (queue->next == queue);
 }
 
+//-----------------------------------------------------------------------------
+static inline bool queue_is_single(queue_t *queue)
+{
+  return (queue->next != queue && queue->next == queue->prev);
+}
+
 #endif // _UTILS_H_
 